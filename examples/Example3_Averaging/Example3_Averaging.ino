@@ -62,7 +62,7 @@ void loop() {
     uint32_t stat_time_sum = 0;
     for (int j=0; j<MEASUREMENTS_PER_MODE; j++) {
 
-      uint16_t start = millis();
+      uint32_t start = millis();
       float temp = TempZero.readInternalTemperature();
       stat_time_sum += (millis() - start);
 
@@ -0,0 +1,41 @@
+#include <TemperatureZero.h>
+
+TemperatureZero TempZero = TemperatureZero();
+
+volatile bool conversionDone = false;
+
+// Called from the ADC interrupt, so only set a flag here
+void onConversion(uint16_t adcReading) {
+  conversionDone = true;
+}
+
+void setup() {
+  // put your setup code here, to run once:
+  Serial.begin(9600);
+  TempZero.init();
+  TempZero.setConversionCallback(onConversion);
+  TempZero.startConversion();
+}
+
+// A conversion with the default 64 samples averaging takes approx 26 ms.
+// Instead of waiting for it, the loop keeps running and counts how often it went around
+// while the ADC was busy.
+uint32_t loopCount = 0;
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  loopCount++;
+
+  // Polling isConversionReady() works as well as the callback does
+  if (conversionDone && TempZero.isConversionReady()) {
+    conversionDone = false;
+    float temperature = TempZero.raw2temp(TempZero.getResult());
+    Serial.print("Internal Temperature is : ");
+    Serial.print(temperature);
+    Serial.print(", loops during conversion : ");
+    Serial.println(loopCount);
+    loopCount = 0;
+    delay(500);
+    TempZero.startConversion();
+  }
+}
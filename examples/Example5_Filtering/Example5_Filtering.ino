@@ -0,0 +1,31 @@
+#include <TemperatureZero.h>
+
+TemperatureZero TempZero = TemperatureZero();
+
+// A long hardware average like TZ_AVERAGING_64 smooths the noisy sensor, but every reading
+// takes its time. A streaming filter gets about the same noise from short TZ_AVERAGING_4
+// reads, as it keeps the history of the previous readings instead.
+// Replace TZ_FILTER_EMA by TZ_FILTER_MEDIAN or TZ_FILTER_KALMAN to try the other filters.
+TemperatureFilter<TZ_FILTER_EMA, 16> filter;
+
+void setup() {
+  // put your setup code here, to run once:
+  Serial.begin(9600);
+  TempZero.init();
+  TempZero.setAveraging(TZ_AVERAGING_4);
+  TempZero.setFilter(&filter);
+}
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  uint32_t start = micros();
+  float temperature = TempZero.readInternalTemperature();
+  uint32_t duration = micros() - start;
+
+  Serial.print("Filtered temperature = ");
+  Serial.print(temperature, 2);
+  Serial.print(" C, read in ");
+  Serial.print(duration);
+  Serial.println(" us");
+  delay(100);
+}
@@ -0,0 +1,24 @@
+#include <TemperatureZero.h>
+#include <TemperatureZeroBench.h>
+
+TemperatureZero TempZero = TemperatureZero();
+TemperatureZeroBench bench = TemperatureZeroBench(TempZero);
+
+// Measures the CPU cycles per call of the reads, for every averaging mode, and of the
+// conversions, along with the noise of the readings. The output is CSV, so logs of different
+// boards or library versions can be compared in a spreadsheet, e.g. to spot a regression.
+#define CALLS_PER_PATH 100
+
+void setup() {
+  // put your setup code here, to run once:
+  Serial.begin(9600);
+  while (!Serial);
+  TempZero.init();
+}
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  bench.run(Serial, CALLS_PER_PATH);
+  Serial.println();
+  delay(10000);
+}
@@ -0,0 +1,31 @@
+#include <TemperatureZero.h>
+
+TemperatureZero TempZero = TemperatureZero();
+
+// scan() converts the die temperature, both supply voltages and a list of analog pins
+// in one pass, setting up the ADC only once per frame. SAMD21 only.
+const uint8_t pins[] = {A1, A2};
+TemperatureZeroFrame frame;
+
+void setup() {
+  // put your setup code here, to run once:
+  Serial.begin(9600);
+  TempZero.init();
+}
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  if (TempZero.scan(frame, pins, sizeof(pins))) {
+    Serial.print("Temperature = ");
+    Serial.print(frame.temperature, 2);
+    Serial.print(" C, VDDCORE = ");
+    Serial.print(frame.coreVoltage, 3);
+    Serial.print(" V, VDDIO = ");
+    Serial.print(frame.ioVoltage, 3);
+    Serial.print(" V, A1 = ");
+    Serial.print(frame.pinReadings[0]);
+    Serial.print(", A2 = ");
+    Serial.println(frame.pinReadings[1]);
+  }
+  delay(1000);
+}
@@ -0,0 +1,24 @@
+#include <TemperatureZero.h>
+#include <TemperatureZeroEncoder.h>
+
+TemperatureZero TempZero = TemperatureZero();
+
+// The ADC converts free running into the ring buffer, and once a second the new samples are sent
+// as packed binary batches, about 2 bytes per sample instead of a line of text. Replace Serial by
+// any Print, e.g. a WiFiClient of WiFi101, and decode with TemperatureZeroEncoder::decode().
+// SAMD21 only.
+uint16_t buffer[128];
+
+void setup() {
+  // put your setup code here, to run once:
+  Serial.begin(115200);
+  TempZero.init();
+  TempZero.setAveraging(TZ_AVERAGING_256);
+  TempZero.startContinuous(buffer, sizeof(buffer) / sizeof(buffer[0]));
+}
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  TemperatureZeroEncoder::writeBuffer(TempZero, Serial);
+  delay(1000);
+}
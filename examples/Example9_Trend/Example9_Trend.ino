@@ -0,0 +1,50 @@
+#include <TemperatureZero.h>
+#include <TemperatureTrend.h>
+
+TemperatureZero TempZero = TemperatureZero();
+
+// The ADC converts free running into the ring buffer, and every buffered sample updates a
+// line fitted through the last 64 samples. Its slope predicts when the die reaches the limit,
+// so e.g. a radio can be throttled before that happens instead of after. SAMD21 only.
+const float limitC = 60.0f;
+uint16_t buffer[128];
+TemperatureTrend<64> trend;
+
+void setup() {
+  // put your setup code here, to run once:
+  Serial.begin(9600);
+  TempZero.init();
+  TempZero.setAveraging(TZ_AVERAGING_256);
+  TempZero.startContinuous(buffer, sizeof(buffer) / sizeof(buffer[0]));
+}
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  TemperatureZeroSample samples[32];
+  uint16_t count;
+  while ((count = TempZero.readSamples(samples, 32)) > 0) {
+    for (uint16_t i = 0; i < count; i++) {
+      trend.update(TempZero.raw2temp(samples[i].raw));
+    }
+    // The buffered samples are timestamped evenly, which gives the sample period
+    if (count > 1) {
+      trend.setSamplePeriod((samples[count - 1].timestamp - samples[0].timestamp) * 1e-6f / (count - 1));
+    }
+  }
+
+  if (trend.isReady()) {
+    Serial.print("Temperature = ");
+    Serial.print(trend.getTemperature(), 2);
+    Serial.print(" C, changing by ");
+    Serial.print(trend.getSlope() * 60, 3);
+    Serial.print(" C/min");
+    float seconds = trend.secondsToThreshold(limitC);
+    if (seconds != TZ_TREND_NEVER) {
+      Serial.print(", limit reached in ");
+      Serial.print(seconds, 0);
+      Serial.print(" s");
+    }
+    Serial.println();
+  }
+  delay(1000);
+}
@@ -0,0 +1,98 @@
+/*
+  bench_math.cpp - Host microbenchmarks of the TemperatureZeroMath conversion paths -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "TemperatureZeroMath.h"
+#include "reference.h"
+
+// Host timings only compare the paths with each other, on the target the float paths are
+// soft-float on the SAMD21 and the cycle counts differ again.
+#define TZ_BENCH_SPARSE_SHIFT 4
+#define TZ_BENCH_SPARSE_SIZE  ((4095 >> TZ_BENCH_SPARSE_SHIFT) + 2)
+
+static volatile float _floatSink;
+static volatile int32_t _integerSink;
+
+static uint16_t _readings[4096];
+static float _temperatures[4096];
+static float _fullTable[4096];
+static float _sparseTable[TZ_BENCH_SPARSE_SIZE];
+
+typedef std::chrono::steady_clock Clock;
+
+static void report(const char *path, Clock::time_point start, unsigned long iterations) {
+  double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  printf("%s,%.2f\n", path, nanoseconds / ((double)iterations * 4096));
+}
+
+int main(int argc, char **argv) {
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+  if (iterations == 0) {
+    iterations = 1;
+  }
+  const TemperatureZeroSamd21Fuses &fuses = referenceSamd21Fuses[0];
+  TemperatureZeroQuadratic coefficients = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(fuses));
+  TemperatureZeroFixedQuadratic milliC = TemperatureZeroMath::fixedQuadratic(fuses);
+  TemperatureZeroMath::buildLookupTable(coefficients, _fullTable, 4096, 0);
+  TemperatureZeroMath::buildLookupTable(coefficients, _sparseTable, TZ_BENCH_SPARSE_SIZE, TZ_BENCH_SPARSE_SHIFT);
+  const float fractionScale = 1.0f / (1 << TZ_BENCH_SPARSE_SHIFT);
+  for (uint16_t reading = 0; reading < 4096; reading++) {
+    _readings[reading] = reading;
+  }
+
+  // Nanoseconds per reading, over all 4096 readings per iteration
+  printf("path,ns_per_reading\n");
+  Clock::time_point start = Clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      _floatSink = referenceRaw2temp<float>(fuses, reading);
+    }
+  }
+  report("original", start, iterations);
+
+  start = Clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      _floatSink = TemperatureZeroMath::raw2temp(coefficients, (float)_readings[reading]);
+    }
+  }
+  report("quadratic", start, iterations);
+
+  start = Clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    TemperatureZeroMath::raw2temp(coefficients, _readings, _temperatures, 4096);
+    _floatSink = _temperatures[i & 4095];
+  }
+  report("batch", start, iterations);
+
+  start = Clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      _integerSink = TemperatureZeroMath::raw2milliC(milliC, _readings[reading]);
+    }
+  }
+  report("fixed_point", start, iterations);
+
+  start = Clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      _floatSink = TemperatureZeroMath::lookupTemperature(_fullTable, 0, 1.0f, _readings[reading]);
+    }
+  }
+  report("lookup_full", start, iterations);
+
+  start = Clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      _floatSink = TemperatureZeroMath::lookupTemperature(_sparseTable, TZ_BENCH_SPARSE_SHIFT, fractionScale,
+                                                          _readings[reading]);
+    }
+  }
+  report("lookup_sparse", start, iterations);
+  return 0;
+}
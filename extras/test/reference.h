@@ -0,0 +1,64 @@
+/*
+  reference.h - Original conversions of TemperatureZero, as golden reference for the host tests -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZERO_REFERENCE_h
+#define TEMPERATUREZERO_REFERENCE_h
+
+#include "TemperatureZeroMath.h"
+
+// Two stage interpolation of the SAMD21 datasheet, chapter 37.10.8, as raw2temp() did it before the
+// coefficients were folded. Templated, so it can be evaluated in float like the library once did,
+// and in double as the exact value.
+template <typename T>
+T referenceRaw2temp(const TemperatureZeroSamd21Fuses &fuses, uint16_t adcReading) {
+  T roomTemperature = fuses.roomInteger + (T)TemperatureZeroMath::convertDecToFrac(fuses.roomDecimal);
+  T hotTemperature = fuses.hotInteger + (T)TemperatureZeroMath::convertDecToFrac(fuses.hotDecimal);
+  T roomInt1vRef = 1 - (T)fuses.roomInt1vRef / 1000;
+  T hotInt1vRef = 1 - (T)fuses.hotInt1vRef / 1000;
+  T roomVoltageCompensated = (T)fuses.roomReading * roomInt1vRef / 4095;
+  T hotVoltageCompensated = (T)fuses.hotReading * hotInt1vRef / 4095;
+
+  // Get course temperature first, in order to estimate the internal 1V reference voltage level at this temperature
+  T measurementVoltage = (T)adcReading / 4095;
+  T coarseTemperature = roomTemperature + ((hotTemperature - roomTemperature) / (hotVoltageCompensated - roomVoltageCompensated)) *
+                        (measurementVoltage - roomVoltageCompensated);
+  // Estimate the reference voltage using the course temperature
+  T ref1VAtMeasurement = roomInt1vRef + ((hotInt1vRef - roomInt1vRef) * (coarseTemperature - roomTemperature)) /
+                         (hotTemperature - roomTemperature);
+  // Now first compensate the raw adc reading using the estimation of the 1V reference output at current temperature
+  T measureVoltageCompensated = (T)adcReading * ref1VAtMeasurement / 4095;
+  // Repeat the temperature interpolation using the compensated measurement voltage
+  return roomTemperature + ((hotTemperature - roomTemperature) / (hotVoltageCompensated - roomVoltageCompensated)) *
+         (measureVoltageCompensated - roomVoltageCompensated);
+}
+
+// SAMD51 datasheet, section 45.6.3.1:
+//   T = (TL*VPH*TC - VPL*TH*TC - TL*VCH*TP + TH*VCL*TP) / (VCL*TP - VCH*TP - VPL*TC + VPH*TC)
+inline double referenceRaw2temp(const TemperatureZeroSamd51Fuses &fuses, uint16_t TP, uint16_t TC) {
+  double TL = fuses.roomInteger + (double)TemperatureZeroMath::convertDecToFrac(fuses.roomDecimal);
+  double TH = fuses.hotInteger + (double)TemperatureZeroMath::convertDecToFrac(fuses.hotDecimal);
+  double VPL = fuses.roomPtat;
+  double VPH = fuses.hotPtat;
+  double VCL = fuses.roomCtat;
+  double VCH = fuses.hotCtat;
+  return (TL * VPH * TC - VPL * TH * TC - TL * VCH * TP + TH * VCL * TP) / (VCL * TP - VCH * TP - VPL * TC + VPH * TC);
+}
+
+// Factory calibrations of a few chips, within the ranges seen on real boards
+static const TemperatureZeroSamd21Fuses referenceSamd21Fuses[] = {
+  // room, hot temperature (integer, decimal), room, hot reading, room, hot 1V reference deviation
+  {25, 3, 83, 8, 2211, 2684, -2, 4},
+  {24, 9, 84, 1, 2190, 2697, 3, -1},
+  {26, 2, 85, 0, 2250, 2710, 0, 0},
+  {23, 75, 82, 5, 2170, 2661, 12, -9}
+};
+
+static const TemperatureZeroSamd51Fuses referenceSamd51Fuses[] = {
+  // room, hot temperature (integer, decimal), room, hot PTAT, room, hot CTAT
+  {25, 4, 85, 2, 2870, 3450, 2540, 2430},
+  {26, 0, 84, 7, 2905, 3482, 2561, 2447}
+};
+
+#endif
@@ -0,0 +1,207 @@
+/*
+  test_encoder.cpp - Host tests of the TemperatureZeroEncoder packing -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "TemperatureZeroEncoder.h"
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+static int _failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool condition, const char *text, const char *file, int line) {
+  if (!condition) {
+    printf("%s:%d: check failed: %s\n", file, line, text);
+    _failures++;
+  }
+}
+
+// TZ_AVERAGING_ modes of TemperatureZero.h, the encoder passes the averaging through as is
+#define TZ_TEST_AVERAGING_1   0
+#define TZ_TEST_AVERAGING_16  4
+#define TZ_TEST_AVERAGING_32  5
+#define TZ_TEST_AVERAGING_256 8
+
+// Longest sequences of the tests, in samples
+#define TZ_TEST_SAMPLES 300
+
+static TemperatureZeroSample _samples[TZ_TEST_SAMPLES];
+static TemperatureZeroSample _decoded[TZ_TEST_SAMPLES];
+static uint8_t _encoded[TZ_ENCODED_SIZE(TZ_TEST_SAMPLES)];
+
+static void setSample(TemperatureZeroSample &sample, uint32_t timestamp, uint16_t raw, uint8_t averaging,
+                      uint8_t flags) {
+  sample.timestamp = timestamp;
+  sample.raw = raw;
+  sample.averaging = averaging;
+  sample.flags = flags;
+}
+
+static bool isSameSample(const TemperatureZeroSample &a, const TemperatureZeroSample &b) {
+  return a.timestamp == b.timestamp && a.raw == b.raw && a.averaging == b.averaging && a.flags == b.flags;
+}
+
+// Decode all batches of length bytes, returns the number of samples, or -1 when a batch does not decode
+// or the batches do not add up to length
+static int decodeAll(const uint8_t *data, size_t length, TemperatureZeroSample *samples, uint16_t capacity,
+                     uint16_t *batches, uint16_t maxBatches, uint16_t &batchCount) {
+  size_t offset = 0;
+  int total = 0;
+  batchCount = 0;
+  while (offset < length) {
+    uint16_t count;
+    size_t used = TemperatureZeroEncoder::decode(data + offset, length - offset, samples + total,
+                                                 capacity - total, count);
+    if (used == 0) {
+      return -1;
+    }
+    if (batchCount < maxBatches) {
+      batches[batchCount] = count;
+    }
+    batchCount++;
+    offset += used;
+    total += count;
+  }
+  return offset == length ? total : -1;
+}
+
+static int decodeAll(const uint8_t *data, size_t length, TemperatureZeroSample *samples, uint16_t capacity) {
+  uint16_t batchCount;
+  return decodeAll(data, length, samples, capacity, NULL, 0, batchCount);
+}
+
+// Layout of a two sample batch, with multi byte and negative varints
+static void testLayout() {
+  setSample(_samples[0], 0x04030201, 0x0605, TZ_TEST_AVERAGING_16, TZ_SAMPLE_BUFFERED);
+  setSample(_samples[1], 0x04030201 + 100, 0x0604, TZ_TEST_AVERAGING_16, TZ_SAMPLE_BUFFERED);
+  const uint8_t expected[] = {
+    TZ_ENCODER_SYNC, 2, TZ_TEST_AVERAGING_16, TZ_SAMPLE_BUFFERED,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0xC8, 0x01, // step change 100, zigzag 200
+    0x01        // raw change -1, zigzag 1
+  };
+  size_t length = TemperatureZeroEncoder::encode(_samples, 2, _encoded, sizeof(_encoded));
+  CHECK(length == sizeof(expected));
+  CHECK(memcmp(_encoded, expected, sizeof(expected)) == 0);
+}
+
+// Changes at the edges of the varint lengths and the zigzag signs, and the extremes of both fields
+static void testRoundTrip() {
+  const int32_t rawChanges[] = {
+    0, 1, -1, 63, -64, 64, -65, 8191, -8192, 8192, -8193, 65535, -65535, 0, 4095, -4095
+  };
+  const uint32_t steps[] = {
+    0, 1, 1, 1000, 1000, 0, 0x7FFFFFFF, 0x80000000, 0x80000001, 0xFFFFFFFF, 0, 63, 64, 8191, 8192, 1
+  };
+  uint16_t count = COUNT_OF(rawChanges);
+  uint32_t timestamp = 0xFFFFFF00; // wraps around within the sequence
+  int32_t raw = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    timestamp += steps[i];
+    raw += rawChanges[i];
+    setSample(_samples[i], timestamp, (uint16_t)raw, TZ_TEST_AVERAGING_1, 0);
+  }
+  size_t length = TemperatureZeroEncoder::encode(_samples, count, _encoded, sizeof(_encoded));
+  CHECK(length > 0);
+  CHECK(length <= TZ_ENCODED_SIZE(count));
+  CHECK(decodeAll(_encoded, length, _decoded, TZ_TEST_SAMPLES) == count);
+  for (uint16_t i = 0; i < count; i++) {
+    CHECK(isSameSample(_samples[i], _decoded[i]));
+  }
+}
+
+// Largest changes of every sample, within one batch and with a batch per sample
+static void testWorstCase() {
+  for (uint16_t count = 1; count <= TZ_TEST_SAMPLES; count++) {
+    // The step alternates between 0 and 2^31, so every change of it takes 5 bytes, the raw reading
+    // between 0 and 0xFFFF, 3 bytes
+    uint32_t timestamp = 0;
+    for (uint16_t i = 0; i < count; i++) {
+      timestamp += (i & 1) ? 0x80000000 : 0;
+      setSample(_samples[i], timestamp, (i & 1) ? 0xFFFF : 0, TZ_TEST_AVERAGING_256, TZ_SAMPLE_OVERRUN);
+    }
+    size_t length = TemperatureZeroEncoder::encode(_samples, count, _encoded, TZ_ENCODED_SIZE(count));
+    CHECK(length > 0 && length <= TZ_ENCODED_SIZE(count));
+    CHECK(TemperatureZeroEncoder::encode(_samples, count, _encoded, TZ_ENCODED_SIZE(count) - 1) == 0);
+    CHECK(decodeAll(_encoded, length, _decoded, TZ_TEST_SAMPLES) == count);
+    CHECK(memcmp(_samples, _decoded, count * sizeof(TemperatureZeroSample)) == 0);
+
+    // Alternating flags end the batch after every sample, which is what TZ_ENCODED_SIZE is sized for
+    for (uint16_t i = 0; i < count; i++) {
+      _samples[i].flags = (i & 1) ? TZ_SAMPLE_OVERRUN : 0;
+    }
+    length = TemperatureZeroEncoder::encode(_samples, count, _encoded, TZ_ENCODED_SIZE(count));
+    CHECK(length == TZ_ENCODED_SIZE(count));
+    CHECK(decodeAll(_encoded, length, _decoded, TZ_TEST_SAMPLES) == count);
+    CHECK(memcmp(_samples, _decoded, count * sizeof(TemperatureZeroSample)) == 0);
+  }
+}
+
+// A new batch starts at every change of the averaging or the flags, and each decodes on its own
+static void testBatchBoundaries() {
+  const uint8_t averaging[] = {
+    TZ_TEST_AVERAGING_16, TZ_TEST_AVERAGING_16, TZ_TEST_AVERAGING_16, TZ_TEST_AVERAGING_32, TZ_TEST_AVERAGING_32,
+    TZ_TEST_AVERAGING_32, TZ_TEST_AVERAGING_32, TZ_TEST_AVERAGING_32, TZ_TEST_AVERAGING_32, TZ_TEST_AVERAGING_32,
+    TZ_TEST_AVERAGING_16
+  };
+  const uint8_t flags[] = { 0, 0, 0, 0, 0, 0, 0, TZ_SAMPLE_BUFFERED, TZ_SAMPLE_BUFFERED, TZ_SAMPLE_BUFFERED, 0 };
+  const uint16_t expectedBatches[] = { 3, 4, 3, 1 };
+  uint16_t count = COUNT_OF(averaging);
+  for (uint16_t i = 0; i < count; i++) {
+    setSample(_samples[i], 1000 + i * 500 + (i % 3), 2000 + i * 7, averaging[i], flags[i]);
+  }
+  size_t length = TemperatureZeroEncoder::encode(_samples, count, _encoded, sizeof(_encoded));
+  CHECK(length > 0);
+
+  uint16_t batches[COUNT_OF(expectedBatches) + 1];
+  uint16_t batchCount;
+  CHECK(decodeAll(_encoded, length, _decoded, TZ_TEST_SAMPLES, batches, COUNT_OF(batches), batchCount) == count);
+  CHECK(batchCount == COUNT_OF(expectedBatches));
+  CHECK(memcmp(batches, expectedBatches, sizeof(expectedBatches)) == 0);
+  CHECK(memcmp(_samples, _decoded, count * sizeof(TemperatureZeroSample)) == 0);
+
+  // The first batch, 3 samples, is complete only with all its bytes, and needs room for 3 samples
+  uint16_t batch;
+  size_t first = TemperatureZeroEncoder::decode(_encoded, length, _decoded, TZ_TEST_SAMPLES, batch);
+  CHECK(first > 0 && batch == 3);
+  for (size_t prefix = 0; prefix < first; prefix++) {
+    CHECK(TemperatureZeroEncoder::decode(_encoded, prefix, _decoded, TZ_TEST_SAMPLES, batch) == 0);
+    CHECK(batch == 0);
+  }
+  CHECK(TemperatureZeroEncoder::decode(_encoded, first, _decoded, TZ_TEST_SAMPLES, batch) == first);
+  CHECK(TemperatureZeroEncoder::decode(_encoded, length, _decoded, 2, batch) == 0);
+  CHECK(TemperatureZeroEncoder::decode(_encoded + 1, length - 1, _decoded, TZ_TEST_SAMPLES, batch) == 0);
+
+  // The second batch starts from its own first sample, not from the time step of the first batch
+  size_t second = TemperatureZeroEncoder::decode(_encoded + first, length - first, _decoded, TZ_TEST_SAMPLES, batch);
+  CHECK(second > 0 && batch == 4);
+  CHECK(isSameSample(_decoded[0], _samples[3]));
+  CHECK(isSameSample(_decoded[3], _samples[6]));
+
+  // Splitting the samples at a boundary gives the same bytes as encoding them at once
+  size_t split = TemperatureZeroEncoder::encode(_samples, 3, _encoded + length, sizeof(_encoded) - length);
+  split += TemperatureZeroEncoder::encode(_samples + 3, count - 3, _encoded + length + split,
+                                          sizeof(_encoded) - length - split);
+  CHECK(split == length);
+  CHECK(memcmp(_encoded, _encoded + length, length) == 0);
+
+  CHECK(TemperatureZeroEncoder::encode(_samples, 0, _encoded, 0) == 0);
+}
+
+int main() {
+  testLayout();
+  testRoundTrip();
+  testWorstCase();
+  testBatchBoundaries();
+  if (_failures != 0) {
+    printf("%d checks failed\n", _failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,197 @@
+/*
+  test_filter.cpp - Host tests of the TemperatureFilter streaming filters -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include <math.h>
+#include <stdio.h>
+
+#include "TemperatureFilter.h"
+
+static int _failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool condition, const char *text, const char *file, int line) {
+  if (!condition) {
+    printf("%s:%d: check failed: %s\n", file, line, text);
+    _failures++;
+  }
+}
+
+// Readings of the noise tests, enough for the variance to settle within a few percent
+#define TZ_TEST_NOISE_READINGS 200000
+
+// Fixed sequence of uniform noise in [-0.5, 0.5), so the results do not change between runs
+static uint32_t _noiseState;
+
+static float noise() {
+  _noiseState = _noiseState * 1664525 + 1013904223;
+  return (float)(_noiseState >> 8) / (float)(1UL << 24) - 0.5f;
+}
+
+// Variance of the output of filter on steady readings with noise of variance 1/12, relative to it
+static double relativeNoiseVariance(TemperatureFilterBase &filter) {
+  _noiseState = 1;
+  filter.reset();
+  double sum = 0;
+  double sumSquares = 0;
+  int count = 0;
+  for (int i = 0; i < TZ_TEST_NOISE_READINGS; i++) {
+    float value = filter.update(25.0f + noise());
+    // Skip the start, up to where the filters have settled
+    if (i >= 1000) {
+      sum += value;
+      sumSquares += (double)value * value;
+      count++;
+    }
+  }
+  double mean = sum / count;
+  return (sumSquares / count - mean * mean) * 12.0;
+}
+
+// Step from 0 to 10: the first reading sets the value, then the distance shrinks by 1 - 2 / (N + 1)
+static void testEmaStepResponse() {
+  TemperatureFilter<TZ_FILTER_EMA, 9> filter;
+  CHECK(filter.update(0.0f) == 0.0f);
+  float expected = 0.0f;
+  for (int i = 0; i < 60; i++) {
+    expected = 10.0f - (10.0f - expected) * 0.8f;
+    float value = filter.update(10.0f);
+    CHECK(fabsf(value - expected) < 1e-5f);
+    CHECK(value <= 10.0f);
+  }
+  CHECK(fabsf(filter.update(10.0f) - 10.0f) < 1e-4f);
+
+  // After reset() the next reading sets the value again, rather than being averaged with the old one
+  filter.reset();
+  CHECK(filter.update(-5.0f) == -5.0f);
+
+  TemperatureFilter<TZ_FILTER_EMA, 1> passThrough;
+  CHECK(passThrough.update(3.0f) == 3.0f);
+  CHECK(passThrough.update(7.5f) == 7.5f);
+
+  // The weight gives the variance of an average of N readings
+  TemperatureFilter<TZ_FILTER_EMA, 16> averaging;
+  double variance = relativeNoiseVariance(averaging);
+  printf("EMA<16> relative noise variance %.5f, 1/16 = %.5f\n", variance, 1.0 / 16);
+  CHECK(fabs(variance * 16 - 1.0) < 0.05);
+}
+
+// Median of the last readings, from a sorted copy, as the filter is documented to return
+template <uint8_t N>
+static float referenceMedian(const float *readings, int count) {
+  int length = count < N ? count : N;
+  float window[N];
+  for (int i = 0; i < length; i++) {
+    window[i] = readings[count - length + i];
+  }
+  for (int i = 1; i < length; i++) {
+    for (int j = i; j > 0 && window[j - 1] > window[j]; j--) {
+      float swap = window[j];
+      window[j] = window[j - 1];
+      window[j - 1] = swap;
+    }
+  }
+  return window[length / 2];
+}
+
+static void testMedianOutliers() {
+  // Up to (N - 1) / 2 outliers within the window are rejected completely, of either sign
+  TemperatureFilter<TZ_FILTER_MEDIAN, 5> filter;
+  CHECK(filter.update(20.0f) == 20.0f);
+  for (int i = 1; i < 100; i++) {
+    float reading = 20.0f;
+    if (i % 5 == 0) {
+      reading = 120.0f;
+    } else if (i % 5 == 2) {
+      reading = -40.0f;
+    }
+    CHECK(filter.update(reading) == 20.0f);
+  }
+
+  // A step passes once it holds the majority of the window
+  filter.reset();
+  for (int i = 0; i < 5; i++) {
+    filter.update(20.0f);
+  }
+  CHECK(filter.update(30.0f) == 20.0f);
+  CHECK(filter.update(30.0f) == 20.0f);
+  CHECK(filter.update(30.0f) == 30.0f);
+
+  // Against a sort of the window, on readings with many repeated values, which the filter has to take
+  // out of its sorted readings one at a time
+  TemperatureFilter<TZ_FILTER_MEDIAN, 7> window;
+  static float readings[1000];
+  _noiseState = 7;
+  for (int i = 0; i < 1000; i++) {
+    readings[i] = floorf(noise() * 8.0f) * 0.25f + 22.0f;
+    CHECK(window.update(readings[i]) == referenceMedian<7>(readings, i + 1));
+  }
+}
+
+static void testKalmanConvergence() {
+  // Steady readings: the first one sets the value, and the noise settles at the EMA of the same N
+  TemperatureFilter<TZ_FILTER_KALMAN, 16> filter;
+  CHECK(filter.update(25.0f) == 25.0f);
+  double variance = relativeNoiseVariance(filter);
+  printf("Kalman<16> relative noise variance %.5f, 1/16 = %.5f\n", variance, 1.0 / 16);
+  CHECK(fabs(variance * 16 - 1.0) < 0.05);
+
+  // Once converged, the gain is the weight of the EMA, 2 / (N + 1)
+  filter.reset();
+  for (int i = 0; i < 1000; i++) {
+    filter.update(25.0f);
+  }
+  float value = filter.update(26.0f);
+  CHECK(fabsf(value - (25.0f + 2.0f / 17)) < 1e-4f);
+
+  // Converges to a step, without overshooting it
+  for (int i = 0; i < 200; i++) {
+    value = filter.update(26.0f);
+    CHECK(value <= 26.0f);
+  }
+  CHECK(fabsf(value - 26.0f) < 1e-4f);
+
+  // With measured variances the gain starts at 1/2 and drops towards sqrt(Q / R)
+  TemperatureFilter<TZ_FILTER_KALMAN, 16> measured;
+  measured.setNoise(0.0001f, 0.01f);
+  measured.update(0.0f);
+  float first = measured.update(1.0f);
+  CHECK(fabsf(first - 0.0101f / 0.0201f) < 1e-5f);
+  measured.reset();
+  for (int i = 0; i < 1000; i++) {
+    measured.update(0.0f);
+  }
+  float gain = measured.update(1.0f);
+  CHECK(gain > 0.08f && gain < 0.11f);
+}
+
+// Through the interface TemperatureZero::setFilter() takes, and destroyed through it
+static void testInterface() {
+  TemperatureFilterBase *filters[] = {
+    new TemperatureFilter<TZ_FILTER_EMA, 4>(),
+    new TemperatureFilter<TZ_FILTER_MEDIAN, 4>(),
+    new TemperatureFilter<TZ_FILTER_KALMAN, 4>()
+  };
+  for (int i = 0; i < 3; i++) {
+    CHECK(filters[i]->update(12.5f) == 12.5f);
+    filters[i]->update(50.0f);
+    filters[i]->reset();
+    CHECK(filters[i]->update(-3.0f) == -3.0f);
+    delete filters[i];
+  }
+}
+
+int main() {
+  testEmaStepResponse();
+  testMedianOutliers();
+  testKalmanConvergence();
+  testInterface();
+  if (_failures != 0) {
+    printf("%d checks failed\n", _failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,345 @@
+/*
+  test_math.cpp - Host tests of TemperatureZeroMath against the original conversions -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include <math.h>
+#include <stdio.h>
+
+#include "TemperatureZeroMath.h"
+#include "reference.h"
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+static int _failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool condition, const char *text, const char *file, int line) {
+  if (!condition) {
+    printf("%s:%d: check failed: %s\n", file, line, text);
+    _failures++;
+  }
+}
+
+// Report the largest error of a path, and check it against the bound it is documented with
+static void checkError(const char *path, double maxError, double bound) {
+  printf("%-36s max error %.6f, bound %.6f\n", path, maxError, bound);
+  if (!(maxError <= bound)) {
+    printf("  error above bound\n");
+    _failures++;
+  }
+}
+
+// Bounds in degrees, over all 4096 readings of every reference chip
+#define QUADRATIC_BOUND        0.0005 // float rounding of the folded coefficients, against the exact value
+#define ORIGINAL_FLOAT_BOUND   0.001  // between the folded coefficients and the original code in float
+#define FIXED_POINT_BOUND      0.002  // integer path, rounded to 1 milli degree
+#define USER_CALIBRATION_BOUND 0.001
+#define FIXED_USER_CAL_BOUND   0.003  // gain and offset rounded to Q16 and milli degrees as well
+#define SAMD51_BOUND           0.0005
+
+// Every 16th reading in the sparse table, as enableLookupTable(table, size, 4)
+#define TZ_TEST_SPARSE_SHIFT 4
+#define TZ_TEST_SPARSE_SIZE  ((4095 >> TZ_TEST_SPARSE_SHIFT) + 2)
+
+static void testDecimals() {
+  CHECK(TemperatureZeroMath::convertDecToFrac(3) == 0.3f);
+  CHECK(TemperatureZeroMath::convertDecToFrac(75) == 0.75f);
+  CHECK(TemperatureZeroMath::convertDecToFrac(125) == 0.125f);
+  CHECK(TemperatureZeroMath::convertDecToMilli(3) == 300);
+  CHECK(TemperatureZeroMath::convertDecToMilli(75) == 750);
+  CHECK(TemperatureZeroMath::convertDecToMilli(125) == 125);
+  CHECK(TemperatureZeroMath::toQ16(1.0f) == 0x10000);
+  CHECK(TemperatureZeroMath::toQ16(-0.5f) == -0x8000);
+  CHECK(TemperatureZeroMath::toMilli(-1.2345f) == -1235);
+  CHECK(TemperatureZeroMath::toMilli(25.0004f) == 25000);
+}
+
+// Fixed readings of the first reference chip, from the original code evaluated in double
+static void testGoldenValues() {
+  static const struct {
+    uint16_t reading;
+    double temperature;
+  } golden[] = {
+    {0, -257.771861},
+    {1024, -124.627411},
+    {2211, 25.316371},
+    {2684, 83.751750},
+    {4095, 253.618280}
+  };
+  TemperatureZeroQuadratic coefficients = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(referenceSamd21Fuses[0]));
+  for (size_t i = 0; i < COUNT_OF(golden); i++) {
+    CHECK(fabs(referenceRaw2temp<double>(referenceSamd21Fuses[0], golden[i].reading) - golden[i].temperature) < 1e-6);
+    CHECK(fabs(TemperatureZeroMath::raw2temp(coefficients, (float)golden[i].reading) - golden[i].temperature) <= QUADRATIC_BOUND);
+  }
+}
+
+// The folded quadratic gives the two stage interpolation, and the batch and table paths the scalar one
+static void testSamd21Conversions() {
+  double quadraticError = 0;
+  double originalError = 0;
+  double fixedError = 0;
+  double batchError = 0;
+  double fullTableError = 0;
+  double sparseTableError = 0;
+  double sparseTableBound = 0;
+  for (size_t chip = 0; chip < COUNT_OF(referenceSamd21Fuses); chip++) {
+    const TemperatureZeroSamd21Fuses &fuses = referenceSamd21Fuses[chip];
+    TemperatureZeroQuadratic coefficients = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(fuses));
+    TemperatureZeroFixedQuadratic milliC = TemperatureZeroMath::fixedQuadratic(fuses);
+
+    static uint16_t readings[4096];
+    static float batch[4096];
+    static float fullTable[4096];
+    static float sparseTable[TZ_TEST_SPARSE_SIZE];
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      readings[reading] = reading;
+    }
+    TemperatureZeroMath::raw2temp(coefficients, readings, batch, 4096);
+    TemperatureZeroMath::buildLookupTable(coefficients, fullTable, 4096, 0);
+    TemperatureZeroMath::buildLookupTable(coefficients, sparseTable, TZ_TEST_SPARSE_SIZE, TZ_TEST_SPARSE_SHIFT);
+    // Linear interpolation of a quadratic is off by at most quadratic * (stride / 2)^2
+    double stride = 1 << TZ_TEST_SPARSE_SHIFT;
+    double bound = fabs(coefficients.quadratic) * stride * stride / 4 + 1e-4;
+    if (bound > sparseTableBound) {
+      sparseTableBound = bound;
+    }
+
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      double exact = referenceRaw2temp<double>(fuses, reading);
+      float scalar = TemperatureZeroMath::raw2temp(coefficients, (float)reading);
+      quadraticError = fmax(quadraticError, fabs(scalar - exact));
+      originalError = fmax(originalError, fabs(scalar - referenceRaw2temp<float>(fuses, reading)));
+      fixedError = fmax(fixedError, fabs(TemperatureZeroMath::raw2milliC(milliC, reading) / 1000.0 - exact));
+      batchError = fmax(batchError, fabs(batch[reading] - scalar));
+      fullTableError = fmax(fullTableError, fabs(TemperatureZeroMath::lookupTemperature(fullTable, 0, 1.0f, reading) - scalar));
+      float sparse = TemperatureZeroMath::lookupTemperature(sparseTable, TZ_TEST_SPARSE_SHIFT, 1.0f / (float)stride, reading);
+      sparseTableError = fmax(sparseTableError, fabs(sparse - scalar));
+    }
+  }
+  checkError("quadratic against exact", quadraticError, QUADRATIC_BOUND);
+  checkError("quadratic against original in float", originalError, ORIGINAL_FLOAT_BOUND);
+  checkError("fixed point against exact", fixedError, FIXED_POINT_BOUND);
+  checkError("batch against scalar", batchError, 0);
+  checkError("full lookup table against scalar", fullTableError, 0);
+  checkError("sparse lookup table against scalar", sparseTableError, sparseTableBound);
+}
+
+// Folding the user calibration into the coefficients equals correcting the result afterwards
+static void testUserCalibration() {
+  const float gainCorrection = 1.0125f;
+  const float offsetCorrection = -0.83f;
+  double floatError = 0;
+  double fixedError = 0;
+  for (size_t chip = 0; chip < COUNT_OF(referenceSamd21Fuses); chip++) {
+    const TemperatureZeroSamd21Fuses &fuses = referenceSamd21Fuses[chip];
+    TemperatureZeroQuadratic coefficients = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(fuses));
+    TemperatureZeroMath::applyUserCalibration(coefficients, gainCorrection, offsetCorrection);
+    TemperatureZeroFixedQuadratic milliC = TemperatureZeroMath::fixedQuadratic(fuses);
+    TemperatureZeroMath::applyUserCalibration(milliC, TemperatureZeroMath::toQ16(gainCorrection),
+                                              TemperatureZeroMath::toMilli(offsetCorrection));
+    for (uint16_t reading = 0; reading < 4096; reading++) {
+      double exact = (referenceRaw2temp<double>(fuses, reading) - offsetCorrection) * gainCorrection;
+      floatError = fmax(floatError, fabs(TemperatureZeroMath::raw2temp(coefficients, (float)reading) - exact));
+      fixedError = fmax(fixedError, fabs(TemperatureZeroMath::raw2milliC(milliC, reading) / 1000.0 - exact));
+    }
+  }
+  checkError("user calibration", floatError, USER_CALIBRATION_BOUND);
+  checkError("fixed point user calibration", fixedError, FIXED_USER_CAL_BOUND);
+
+  // Two measurements taken with a known gain and offset give them back
+  float gain;
+  float offset;
+  float cold = 5.0f;
+  float hot = 60.0f;
+  TemperatureZeroMath::solveUserCalibration2P(cold, cold / gainCorrection + offsetCorrection,
+                                              hot, hot / gainCorrection + offsetCorrection, gain, offset);
+  CHECK(fabs(gain - gainCorrection) < 1e-5);
+  CHECK(fabs(offset - offsetCorrection) < 1e-4);
+}
+
+// Points of the piecewise user calibration tests, a slight S curve with unequal segments
+static const float calibrationMeasurements[] = {-20.0f, 5.0f, 25.0f, 60.0f, 95.0f};
+static const float calibrationGroundTruths[] = {-18.5f, 5.75f, 25.25f, 59.0f, 96.5f};
+#define TZ_TEST_POINTS ((uint8_t)COUNT_OF(calibrationMeasurements))
+
+// Piecewise linear correction between the points, and along the outer segments beyond them
+static double referenceCalibration(double temperature) {
+  size_t segment = 0;
+  while (segment + 2 < TZ_TEST_POINTS && temperature >= calibrationMeasurements[segment + 1]) {
+    segment++;
+  }
+  double slope = (calibrationGroundTruths[segment + 1] - calibrationGroundTruths[segment]) /
+                 (calibrationMeasurements[segment + 1] - calibrationMeasurements[segment]);
+  return calibrationGroundTruths[segment] + slope * (temperature - calibrationMeasurements[segment]);
+}
+
+static void testCalibrationPoints() {
+  TemperatureZeroCalibrationPoint points[TZ_TEST_POINTS];
+  TemperatureZeroMath::compileCalibrationPoints(points, calibrationMeasurements, calibrationGroundTruths, TZ_TEST_POINTS);
+  for (uint8_t i = 0; i < TZ_TEST_POINTS; i++) {
+    CHECK(fabs(TemperatureZeroMath::calibrationGroundTruth(points, i) - calibrationGroundTruths[i]) < 1e-4);
+    CHECK(fabs(TemperatureZeroMath::applyCalibrationPoints(points, TZ_TEST_POINTS, calibrationMeasurements[i]) -
+               calibrationGroundTruths[i]) < 1e-4);
+    // A point starts its segment, the last one closes the last segment
+    uint8_t segment = i + 1 < TZ_TEST_POINTS ? i : TZ_TEST_POINTS - 2;
+    CHECK(TemperatureZeroMath::findCalibrationSegment(points, TZ_TEST_POINTS, calibrationMeasurements[i]) == segment);
+  }
+  CHECK(TemperatureZeroMath::findCalibrationSegment(points, TZ_TEST_POINTS, -100.0f) == 0);
+  CHECK(TemperatureZeroMath::findCalibrationSegment(points, TZ_TEST_POINTS, 200.0f) == TZ_TEST_POINTS - 2);
+  // Two points are a single segment, like a gain and offset
+  CHECK(TemperatureZeroMath::findCalibrationSegment(points, 2, 50.0f) == 0);
+
+  double floatError = 0;
+  double fixedError = 0;
+  for (int32_t milliC = -60000; milliC <= 140000; milliC += 125) {
+    double exact = referenceCalibration(milliC / 1000.0);
+    floatError = fmax(floatError, fabs(TemperatureZeroMath::applyCalibrationPoints(points, TZ_TEST_POINTS, milliC / 1000.0f) - exact));
+    int32_t fixed = TemperatureZeroMath::applyCalibrationPointsMilliC(points, TZ_TEST_POINTS, milliC);
+    fixedError = fmax(fixedError, fabs(fixed / 1000.0 - exact));
+  }
+  checkError("calibration points", floatError, USER_CALIBRATION_BOUND);
+  checkError("fixed point calibration points", fixedError, FIXED_USER_CAL_BOUND);
+}
+
+// temp2raw() gives the lowest reading converting to more than the temperature, with and without points
+static void testTemp2raw() {
+  TemperatureZeroCalibrationPoint points[TZ_TEST_POINTS];
+  TemperatureZeroMath::compileCalibrationPoints(points, calibrationMeasurements, calibrationGroundTruths, TZ_TEST_POINTS);
+  for (size_t chip = 0; chip < COUNT_OF(referenceSamd21Fuses); chip++) {
+    TemperatureZeroQuadratic coefficients = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(referenceSamd21Fuses[chip]));
+    for (uint8_t pointCount = 0; pointCount <= TZ_TEST_POINTS; pointCount += TZ_TEST_POINTS) {
+      for (float celsius = -40.0f; celsius <= 125.0f; celsius += 0.37f) {
+        uint16_t reading = TemperatureZeroMath::temp2raw(coefficients, points, pointCount, celsius);
+        float below = TemperatureZeroMath::raw2temp(coefficients, (float)(reading - 1));
+        float at = TemperatureZeroMath::raw2temp(coefficients, (float)reading);
+        if (pointCount != 0) {
+          below = TemperatureZeroMath::applyCalibrationPoints(points, pointCount, below);
+          at = TemperatureZeroMath::applyCalibrationPoints(points, pointCount, at);
+        }
+        CHECK(reading == 0 || below <= celsius);
+        CHECK(reading == 4096 || at > celsius);
+      }
+    }
+    // Beyond the range of the readings every reading, or none, is above the temperature
+    CHECK(TemperatureZeroMath::temp2raw(coefficients, NULL, 0, -1000.0f) == 0);
+    CHECK(TemperatureZeroMath::temp2raw(coefficients, NULL, 0, 1000.0f) == 4096);
+  }
+}
+
+// Decimated sums of identical readings convert like the reading, the extra bits keep the fraction
+static void testOversampling() {
+  TemperatureZeroQuadratic coefficients = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(referenceSamd21Fuses[0]));
+  double maxError = 0;
+  for (uint8_t extraBits = 0; extraBits <= 4; extraBits++) {
+    uint32_t count = 1UL << (2 * extraBits);
+    for (uint16_t reading = 0; reading < 4096; reading += 45) {
+      uint32_t oversampled = TemperatureZeroMath::decimate(reading * count, extraBits);
+      CHECK(oversampled == (uint32_t)reading << extraBits);
+      float scalar = TemperatureZeroMath::raw2temp(coefficients, (float)reading);
+      maxError = fmax(maxError, fabs(TemperatureZeroMath::raw2temp(coefficients, oversampled, extraBits) - scalar));
+      if (extraBits != 0 && reading < 4095) {
+        // Half of the readings one step higher land halfway between the steps
+        uint32_t halfway = TemperatureZeroMath::decimate(reading * count + count / 2, extraBits);
+        float between = TemperatureZeroMath::raw2temp(coefficients, reading + 0.5f);
+        maxError = fmax(maxError, fabs(TemperatureZeroMath::raw2temp(coefficients, halfway, extraBits) - between));
+      }
+    }
+  }
+  checkError("oversampled against scalar", maxError, 1e-4);
+}
+
+// The compensated coefficients give the refined interpolation with the measured 1V reference
+static void testCompensated() {
+  const TemperatureZeroSamd21Fuses &fuses = referenceSamd21Fuses[0];
+  TemperatureZeroSamd21Calibration calibration = TemperatureZeroMath::calibration(fuses);
+  TemperatureZeroLinear coefficients = TemperatureZeroMath::compensated(calibration, 1.1f);
+  double slope = (calibration.hotTemperature - calibration.roomTemperature) /
+                 (calibration.hotVoltageCompensated - calibration.roomVoltageCompensated);
+  double maxError = 0;
+  for (uint16_t bandgapReading = 1900; bandgapReading <= 2200; bandgapReading += 50) {
+    for (uint16_t reading = 2000; reading <= 2900; reading += 100) {
+      double ref1V = 1.1 * 4095 / (2.0 * bandgapReading);
+      double exact = calibration.roomTemperature + slope * (reading * ref1V / 4095 - calibration.roomVoltageCompensated);
+      float result = TemperatureZeroMath::raw2temp(coefficients, (float)reading / (float)bandgapReading);
+      maxError = fmax(maxError, fabs(result - exact));
+    }
+  }
+  checkError("compensated against exact", maxError, QUADRATIC_BOUND);
+}
+
+// With the bandgap voltage calibrated on a reading, the compensated conversion of that reading equals
+// the factory conversion, whatever the bandgap reading was
+static void testBandgapCalibration() {
+  double maxError = 0;
+  for (size_t chip = 0; chip < COUNT_OF(referenceSamd21Fuses); chip++) {
+    TemperatureZeroSamd21Calibration calibration = TemperatureZeroMath::calibration(referenceSamd21Fuses[chip]);
+    TemperatureZeroQuadratic factory = TemperatureZeroMath::quadratic(calibration);
+    for (uint16_t bandgapReading = 1900; bandgapReading <= 2200; bandgapReading += 50) {
+      for (uint16_t reading = 2000; reading <= 2900; reading += 100) {
+        float bandgapVoltage = TemperatureZeroMath::bandgapVoltage(calibration, reading, bandgapReading);
+        TemperatureZeroLinear coefficients = TemperatureZeroMath::compensated(calibration, bandgapVoltage);
+        float result = TemperatureZeroMath::raw2temp(coefficients, (float)reading / (float)bandgapReading);
+        maxError = fmax(maxError, fabs(result - TemperatureZeroMath::raw2temp(factory, reading)));
+      }
+    }
+  }
+  checkError("calibrated bandgap against factory", maxError, QUADRATIC_BOUND);
+}
+
+// The grouped rational form and its batch equal the datasheet formula, with the user calibration folded
+static void testSamd51Conversions() {
+  const float gainCorrection = 0.98f;
+  const float offsetCorrection = 1.5f;
+  double maxError = 0;
+  double userCalError = 0;
+  double batchError = 0;
+  for (size_t chip = 0; chip < COUNT_OF(referenceSamd51Fuses); chip++) {
+    const TemperatureZeroSamd51Fuses &fuses = referenceSamd51Fuses[chip];
+    TemperatureZeroRational coefficients = TemperatureZeroMath::rational(TemperatureZeroMath::calibration(fuses));
+    TemperatureZeroRational corrected = coefficients;
+    TemperatureZeroMath::applyUserCalibration(corrected, gainCorrection, offsetCorrection);
+    uint16_t TP[128];
+    uint16_t TC[128];
+    float batch[128];
+    size_t count = 0;
+    for (uint16_t ptat = 2700; ptat < 3600; ptat += 113) {
+      for (uint16_t ctat = 2350; ctat < 2650; ctat += 37) {
+        double exact = referenceRaw2temp(fuses, ptat, ctat);
+        maxError = fmax(maxError, fabs(TemperatureZeroMath::raw2temp(coefficients, ptat, ctat) - exact));
+        double exactCorrected = (exact - offsetCorrection) * gainCorrection;
+        userCalError = fmax(userCalError, fabs(TemperatureZeroMath::raw2temp(corrected, ptat, ctat) - exactCorrected));
+        TP[count] = ptat;
+        TC[count] = ctat;
+        count++;
+      }
+    }
+    TemperatureZeroMath::raw2temp(coefficients, TP, TC, batch, count);
+    for (size_t i = 0; i < count; i++) {
+      batchError = fmax(batchError, fabs(batch[i] - TemperatureZeroMath::raw2temp(coefficients, TP[i], TC[i])));
+    }
+  }
+  checkError("SAMD51 rational against datasheet", maxError, SAMD51_BOUND);
+  checkError("SAMD51 user calibration", userCalError, SAMD51_BOUND);
+  checkError("SAMD51 batch against scalar", batchError, 0);
+}
+
+int main() {
+  testDecimals();
+  testGoldenValues();
+  testSamd21Conversions();
+  testUserCalibration();
+  testCalibrationPoints();
+  testTemp2raw();
+  testOversampling();
+  testCompensated();
+  testBandgapCalibration();
+  testSamd51Conversions();
+  if (_failures != 0) {
+    printf("%d checks failed\n", _failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,162 @@
+/*
+  test_trend.cpp - Host tests of the TemperatureTrend least squares line -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include <math.h>
+#include <stdio.h>
+
+#include "TemperatureTrend.h"
+
+static int _failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool condition, const char *text, const char *file, int line) {
+  if (!condition) {
+    printf("%s:%d: check failed: %s\n", file, line, text);
+    _failures++;
+  }
+}
+
+// Window and spacing of the ramps, with steps that are exact in float, so the line is exact as well
+#define TZ_TEST_WINDOW 8
+#define TZ_TEST_PERIOD 0.25f // seconds
+#define TZ_TEST_STEP   0.5f  // degrees per reading, 2 degrees per second
+
+static float ramp(int i) {
+  return 20.0f + TZ_TEST_STEP * i;
+}
+
+static void testFewReadings() {
+  TemperatureTrend<TZ_TEST_WINDOW> trend(TZ_TEST_PERIOD);
+  CHECK(trend.getCount() == 0);
+  CHECK(trend.getSlope() == 0.0f);
+  CHECK(trend.getTemperature() == 0.0f);
+  CHECK(trend.secondsToThreshold(30.0f) == TZ_TREND_NEVER);
+
+  trend.update(21.5f);
+  CHECK(trend.getCount() == 1);
+  CHECK(trend.getSlope() == 0.0f);
+  CHECK(trend.getTemperature() == 21.5f);
+  CHECK(trend.secondsToThreshold(21.5f) == 0.0f);
+  CHECK(trend.secondsToThreshold(30.0f) == TZ_TREND_NEVER);
+
+  trend.update(22.0f);
+  CHECK(trend.getSlope() == 2.0f);
+  CHECK(trend.getTemperature() == 22.0f);
+  CHECK(!trend.isReady());
+}
+
+// The line through a ramp has its slope, and passes through the latest reading, while the window fills,
+// once it slides, and across the recomputation of the sums every N updates
+static void testRamp() {
+  TemperatureTrend<TZ_TEST_WINDOW> trend(TZ_TEST_PERIOD);
+  for (int i = 0; i < 5 * TZ_TEST_WINDOW + 3; i++) {
+    trend.update(ramp(i));
+    CHECK(trend.getCount() == (i < TZ_TEST_WINDOW ? i + 1 : TZ_TEST_WINDOW));
+    CHECK(trend.isReady() == (i >= TZ_TEST_WINDOW - 1));
+    if (i > 0) {
+      CHECK(trend.getSlope() == TZ_TEST_STEP / TZ_TEST_PERIOD);
+    }
+    CHECK(trend.getTemperature() == ramp(i));
+  }
+
+  // A falling ramp takes over completely once it fills the window
+  for (int i = 0; i < 3 * TZ_TEST_WINDOW; i++) {
+    trend.update(60.0f - TZ_TEST_STEP * i);
+    if (i >= TZ_TEST_WINDOW - 1) {
+      CHECK(trend.getSlope() == -TZ_TEST_STEP / TZ_TEST_PERIOD);
+      CHECK(trend.getTemperature() == 60.0f - TZ_TEST_STEP * i);
+    }
+  }
+
+  // The sample period only scales the slope
+  trend.setSamplePeriod(2 * TZ_TEST_PERIOD);
+  CHECK(trend.getSlope() == -TZ_TEST_STEP / (2 * TZ_TEST_PERIOD));
+
+  // Feeding an array gives the same line as feeding the readings one at a time
+  float readings[2 * TZ_TEST_WINDOW + 1];
+  for (int i = 0; i < 2 * TZ_TEST_WINDOW + 1; i++) {
+    readings[i] = ramp(i);
+  }
+  TemperatureTrend<TZ_TEST_WINDOW> batch(TZ_TEST_PERIOD);
+  batch.update(readings, 2 * TZ_TEST_WINDOW + 1);
+  CHECK(batch.getSlope() == TZ_TEST_STEP / TZ_TEST_PERIOD);
+  CHECK(batch.getTemperature() == ramp(2 * TZ_TEST_WINDOW));
+
+  trend.reset();
+  CHECK(trend.getCount() == 0);
+  trend.update(5.0f);
+  CHECK(trend.getTemperature() == 5.0f);
+}
+
+// Steps that are not exact in float, up and down the range of the sensors over many windows, where only
+// the recomputation of the sums keeps the rounding from adding up
+static void testLongRamp() {
+  TemperatureTrend<64> trend(0.1f);
+  double maxSlopeError = 0;
+  double maxTemperatureError = 0;
+  double temperature = -40.0;
+  double step = 0.0123;
+  int sinceTurn = 0;
+  for (int i = 0; i < 100000; i++) {
+    if (temperature + step > 125.0 || temperature + step < -40.0) {
+      step = -step;
+      sinceTurn = 0;
+    }
+    temperature += step;
+    trend.update((float)temperature);
+    if (++sinceTurn >= 64) {
+      maxSlopeError = fmax(maxSlopeError, fabs(trend.getSlope() - step / 0.1));
+      maxTemperatureError = fmax(maxTemperatureError, fabs(trend.getTemperature() - temperature));
+    }
+  }
+  printf("TemperatureTrend<64> max slope error %.6f, max temperature error %.6f\n", maxSlopeError,
+         maxTemperatureError);
+  CHECK(maxSlopeError < 1e-3);
+  CHECK(maxTemperatureError < 2e-3);
+}
+
+static void testSecondsToThreshold() {
+  TemperatureTrend<TZ_TEST_WINDOW> rising(TZ_TEST_PERIOD);
+  for (int i = 0; i < TZ_TEST_WINDOW + 2; i++) {
+    rising.update(ramp(i));
+  }
+  float latest = ramp(TZ_TEST_WINDOW + 1);
+  CHECK(rising.secondsToThreshold(latest + 10.0f) == 5.0f);
+  CHECK(rising.secondsToThreshold(latest) == 0.0f);
+  // Below a rising temperature, or already passed
+  CHECK(rising.secondsToThreshold(latest - 1.0f) == TZ_TREND_NEVER);
+
+  TemperatureTrend<TZ_TEST_WINDOW> falling(TZ_TEST_PERIOD);
+  for (int i = 0; i < TZ_TEST_WINDOW + 2; i++) {
+    falling.update(40.0f - TZ_TEST_STEP * i);
+  }
+  latest = 40.0f - TZ_TEST_STEP * (TZ_TEST_WINDOW + 1);
+  CHECK(falling.secondsToThreshold(latest - 4.0f) == 2.0f);
+  CHECK(falling.secondsToThreshold(latest + 4.0f) == TZ_TREND_NEVER);
+
+  // No trend, on either side of a steady temperature
+  TemperatureTrend<TZ_TEST_WINDOW> steady(TZ_TEST_PERIOD);
+  for (int i = 0; i < 3 * TZ_TEST_WINDOW; i++) {
+    steady.update(30.0f);
+  }
+  CHECK(steady.getSlope() == 0.0f);
+  CHECK(steady.secondsToThreshold(31.0f) == TZ_TREND_NEVER);
+  CHECK(steady.secondsToThreshold(29.0f) == TZ_TREND_NEVER);
+  CHECK(steady.secondsToThreshold(30.0f) == 0.0f);
+}
+
+int main() {
+  testFewReadings();
+  testRamp();
+  testLongRamp();
+  testSecondsToThreshold();
+  if (_failures != 0) {
+    printf("%d checks failed\n", _failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,164 @@
+/*
+  TemperatureFilter.h - Streaming filters for the internal temperature readings of TemperatureZero -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREFILTER_h
+#define TEMPERATUREFILTER_h
+
+#include <stdint.h>
+
+enum TemperatureFilterKind {
+  TZ_FILTER_EMA,
+  TZ_FILTER_MEDIAN,
+  TZ_FILTER_KALMAN
+};
+
+// Common interface, so any filter can be attached with TemperatureZero::setFilter()
+class TemperatureFilterBase
+{
+  public:
+    virtual ~TemperatureFilterBase() {}
+    virtual float update(float temperature) = 0;
+    virtual void reset() = 0;
+};
+
+// Streaming filter over the last N readings, without any heap use
+// TemperatureFilter<TZ_FILTER_EMA, 64> gives about the noise of TZ_AVERAGING_64 on TZ_AVERAGING_1 reads.
+template <TemperatureFilterKind Kind, uint8_t N>
+class TemperatureFilter;
+
+// Exponential moving average with the weight 2 / (N + 1), which has the variance of an N sample average
+template <uint8_t N>
+class TemperatureFilter<TZ_FILTER_EMA, N> : public TemperatureFilterBase
+{
+  static_assert(N > 0, "TemperatureFilter needs N > 0");
+
+  public:
+    TemperatureFilter() {
+      reset();
+    }
+
+    float update(float temperature) {
+      if (_isEmpty) {
+        _value = temperature;
+        _isEmpty = false;
+      } else {
+        _value += (temperature - _value) * (2.0f / (N + 1));
+      }
+      return _value;
+    }
+
+    void reset() {
+      _value = 0;
+      _isEmpty = true;
+    }
+
+  private:
+    float _value;
+    bool _isEmpty;
+};
+
+// Median of the last N readings, rejecting single outliers completely
+// The readings are kept sorted as well, so an update moves at most N values and never sorts.
+template <uint8_t N>
+class TemperatureFilter<TZ_FILTER_MEDIAN, N> : public TemperatureFilterBase
+{
+  static_assert(N > 0, "TemperatureFilter needs N > 0");
+
+  public:
+    TemperatureFilter() {
+      reset();
+    }
+
+    float update(float temperature) {
+      uint8_t position;
+      if (_count < N) {
+        position = _count++;
+      } else {
+        // Take the oldest reading out of the sorted readings
+        float oldest = _history[_next];
+        position = 0;
+        while (position < N - 1 && _sorted[position] != oldest) {
+          position++;
+        }
+        while (position < N - 1) {
+          _sorted[position] = _sorted[position + 1];
+          position++;
+        }
+      }
+      _history[_next] = temperature;
+      if (++_next == N) {
+        _next = 0;
+      }
+      // Insert the new reading, shifting the larger readings up
+      while (position > 0 && _sorted[position - 1] > temperature) {
+        _sorted[position] = _sorted[position - 1];
+        position--;
+      }
+      _sorted[position] = temperature;
+      return _sorted[_count / 2];
+    }
+
+    void reset() {
+      _count = 0;
+      _next = 0;
+    }
+
+  private:
+    float _history[N];
+    float _sorted[N];
+    uint8_t _count;
+    uint8_t _next;
+};
+
+// Scalar Kalman filter for a slowly drifting temperature
+// Per default, the noise ratio gives the same steady state smoothing as the EMA over N readings,
+// setNoise() sets the variances directly, e.g. the measured variance of Example3_Averaging.
+template <uint8_t N>
+class TemperatureFilter<TZ_FILTER_KALMAN, N> : public TemperatureFilterBase
+{
+  static_assert(N > 1, "TemperatureFilter<TZ_FILTER_KALMAN, N> needs N > 1");
+
+  public:
+    TemperatureFilter() {
+      const float weight = 2.0f / (N + 1);
+      _measurementVariance = 1.0f;
+      _processVariance = weight * weight / (1.0f - weight);
+      reset();
+    }
+
+    void setNoise(float processVariance, float measurementVariance) {
+      _processVariance = processVariance;
+      _measurementVariance = measurementVariance;
+    }
+
+    float update(float temperature) {
+      if (_isEmpty) {
+        _value = temperature;
+        _errorVariance = _measurementVariance;
+        _isEmpty = false;
+        return _value;
+      }
+      _errorVariance += _processVariance;
+      float gain = _errorVariance / (_errorVariance + _measurementVariance);
+      _value += gain * (temperature - _value);
+      _errorVariance *= 1.0f - gain;
+      return _value;
+    }
+
+    void reset() {
+      _value = 0;
+      _errorVariance = 0;
+      _isEmpty = true;
+    }
+
+  private:
+    float _value;
+    float _errorVariance;
+    float _processVariance;
+    float _measurementVariance;
+    bool _isEmpty;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+  TemperatureTrend.h - Rate of change of the internal temperature readings of TemperatureZero -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATURETREND_h
+#define TEMPERATURETREND_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returned by secondsToThreshold() when the trend does not approach the threshold
+#define TZ_TREND_NEVER -1.0f
+
+// Least squares line through the last N regularly spaced readings, without any heap use
+// An update adjusts the running sums for the reading that enters and the one that leaves the window,
+// so it takes a few multiply-adds whatever N is. To keep the float rounding from adding up, the sums
+// are recomputed from the readings once every N updates.
+// The readings are expected every setSamplePeriod() seconds, e.g. those of the ring buffer of
+// startContinuous() or startScheduledSampling(), see Example9_Trend.
+template <uint8_t N>
+class TemperatureTrend
+{
+  static_assert(N > 1, "TemperatureTrend needs N > 1");
+
+  public:
+    TemperatureTrend(float samplePeriodSeconds = 1.0f) {
+      _samplePeriod = samplePeriodSeconds;
+      reset();
+    }
+
+    void setSamplePeriod(float seconds) {
+      _samplePeriod = seconds;
+    }
+
+    void update(float temperature) {
+      if (_count == 0) {
+        // Sum the readings relative to the first one, so they stay small against the rounding
+        _origin = temperature;
+      }
+      float reading = temperature - _origin;
+      if (_count < N) {
+        _sumXY += _count * reading;
+        _sumY += reading;
+        _history[_count++] = reading;
+      } else {
+        // Every reading moves one position back, the oldest one at 0 drops out
+        float oldest = _history[_next];
+        _history[_next] = reading;
+        if (++_next == N) {
+          _next = 0;
+        }
+        if (++_updates == N) {
+          refresh();
+        } else {
+          _sumXY += (N - 1) * reading - (_sumY - oldest);
+          _sumY += reading - oldest;
+        }
+      }
+    }
+
+    void update(const float *temperatures, size_t count) {
+      for (size_t i = 0; i < count; i++) {
+        update(temperatures[i]);
+      }
+    }
+
+    void reset() {
+      _sumY = 0;
+      _sumXY = 0;
+      _count = 0;
+      _next = 0;
+      _updates = 0;
+    }
+
+    // True once the window holds N readings, before the slope is taken over fewer
+    bool isReady() {
+      return _count == N;
+    }
+
+    uint8_t getCount() {
+      return _count;
+    }
+
+    // Slope of the line in degrees Celsius per second, 0 with fewer than two readings
+    float getSlope() {
+      if (_count < 2) {
+        return 0;
+      }
+      // sum(x) and sum(x * x) over x = 0 .. n - 1 are known, which leaves the two running sums
+      float n = _count;
+      float numerator = n * _sumXY - n * (n - 1) / 2 * _sumY;
+      float denominator = n * n * (n * n - 1) / 12;
+      return numerator / denominator / _samplePeriod;
+    }
+
+    // Temperature of the line at the latest reading, less noisy than the reading itself
+    float getTemperature() {
+      if (_count == 0) {
+        return 0;
+      }
+      return _origin + _sumY / _count + getSlope() * _samplePeriod * (_count - 1) / 2;
+    }
+
+    // Seconds until the line reaches threshold, 0 when it is on it, or TZ_TREND_NEVER when the
+    // temperature stays or moves away from it. Check getTemperature() for a threshold that is
+    // already passed, the trend then moves away from it as well.
+    float secondsToThreshold(float threshold) {
+      float slope = getSlope();
+      float difference = threshold - getTemperature();
+      if (difference == 0) {
+        return 0;
+      }
+      if (slope == 0 || (difference > 0) != (slope > 0)) {
+        return TZ_TREND_NEVER;
+      }
+      return difference / slope;
+    }
+
+  private:
+    void refresh() {
+      _updates = 0;
+      _sumY = 0;
+      _sumXY = 0;
+      for (uint8_t i = 0; i < N; i++) {
+        float reading = _history[(_next + i) % N];
+        _sumY += reading;
+        _sumXY += i * reading;
+      }
+    }
+
+    float _history[N];
+    float _origin;
+    float _samplePeriod;
+    float _sumY;
+    float _sumXY;
+    uint8_t _count;
+    uint8_t _next;
+    uint8_t _updates;
+};
+
+#endif
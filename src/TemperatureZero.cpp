@@ -12,65 +12,143 @@
 
 #define ADC_12BIT_FULL_SCALE_VALUE_FLOAT 4095.0
 
+#ifndef TZ_WITH_DEBUG_CODE
+static_assert(sizeof(TemperatureZero) <= TZ_OBJECT_SIZE_BUDGET, "TemperatureZero exceeds TZ_OBJECT_SIZE_BUDGET");
+#endif
+
+#ifdef TZ_WITH_STATS
+static TemperatureZeroStats _stats;
+#define TZ_STATS_ADD(counter, amount) (_stats.counter += (amount))
+#define TZ_STATS_BEGIN_READ() uint32_t statsStart = micros()
+#define TZ_STATS_END_READ() (_stats.reads++, _stats.busyMicros += micros() - statsStart)
+
+#ifdef __SAMD51__
+// Account a finished wait for the ADC synchronization, on the SAMD21 TemperatureZeroAdc does so
+static inline void addSyncSpins(uint32_t spins) {
+  _stats.syncWaits++;
+  _stats.syncSpins += spins;
+  if (spins > _stats.maxSyncSpins) {
+    _stats.maxSyncSpins = spins;
+  }
+}
+#endif
+#else
+#define TZ_STATS_ADD(counter, amount)
+#define TZ_STATS_BEGIN_READ()
+#define TZ_STATS_END_READ()
+#endif
+
 #ifdef __SAMD51__ // M4
 // m4 SAMD51 chip temperature sensor on ADC
-// Decimal to fraction conversion. (adapted from ASF sample).
 //#define NVMCTRL_TEMP_LOG              (0x00800100)  // ref pg 59
 #define NVMCTRL_TEMP_LOG NVMCTRL_TEMP_LOG_W0
+#else
+TemperatureZero * volatile TemperatureZero::_activeConversion = NULL;
+TemperatureZero * volatile TemperatureZero::_activeContinuous = NULL;
+volatile uint8_t TemperatureZero::_blockingClaims = 0;
+TemperatureZero *TemperatureZero::_bufferOwner = NULL;
+uint16_t *TemperatureZero::_buffer = NULL;
+volatile uint32_t TemperatureZero::_bufferWraps = 0;
+uint32_t TemperatureZero::_bufferWritten = 0;
+uint32_t TemperatureZero::_bufferConsumed = 0;
+uint32_t TemperatureZero::_overrunCount = 0;
+uint32_t TemperatureZero::_bufferAnchorMicros = 0;
+uint32_t TemperatureZero::_bufferAnchorWritten = 0;
+uint32_t TemperatureZero::_bufferStopMicros = 0;
+TemperatureZeroBufferCallback TemperatureZero::_bufferCallback = NULL;
+uint16_t TemperatureZero::_bufferLength = 0;
+uint8_t TemperatureZero::_scheduledGenerator = 0;
+TemperatureZero *TemperatureZero::_alarmOwner = NULL;
+TemperatureZeroCallback TemperatureZero::_alarmCallback = NULL;
+uint16_t TemperatureZero::_alarmLow = 0;
+uint16_t TemperatureZero::_alarmHigh = 4096;
+volatile bool TemperatureZero::_isAlarmArmed = false;
+
+// DMAC descriptor tables, only used when no other library has enabled the DMAC before
+static DmacDescriptor _dmaDescriptors[TZ_DMA_CHANNEL + 1] __attribute__((aligned(16)));
+static DmacDescriptor _dmaWriteback[TZ_DMA_CHANNEL + 1] __attribute__((aligned(16)));
+
+// Descriptor of the DMA channel, in the table of whoever enabled the DMAC
+static inline DmacDescriptor *dmaDescriptor() {
+  return (DmacDescriptor *)DMAC->BASEADDR.reg + TZ_DMA_CHANNEL;
+}
 
-static float convert_dec_to_frac(uint8_t val) {
-  float float_val = (float)val;
-  if (val < 10) {
-    return (float_val / 10.0);
-  } else if (val < 100) {
-    return (float_val / 100.0);
-  } else {
-    return (float_val / 1000.0);
+// Whether another library has the DMA channel enabled, or a valid descriptor set up for it
+// With interrupts disabled, as the channel is selected through CHID.
+static bool isDmaChannelTaken() {
+  if (!DMAC->CTRL.bit.DMAENABLE) {
+    return false;
+  }
+  uint8_t channel = DMAC->CHID.reg;
+  DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+  bool isEnabled = DMAC->CHCTRLA.bit.ENABLE;
+  DMAC->CHID.reg = channel;
+  return isEnabled || dmaDescriptor()->BTCTRL.bit.VALID;
+}
+
+// Whether the channel still runs the descriptor of a buffer ending at end, which stops being the case
+// when another library resets the DMAC, e.g. Adafruit_ZeroDMA when it starts after the buffer.
+// With interrupts disabled, like isDmaChannelTaken().
+static bool isDmaChannelOurs(const uint16_t *end) {
+  DmacDescriptor *descriptor = dmaDescriptor();
+  return DMAC->CTRL.bit.DMAENABLE && descriptor->SRCADDR.reg == (uint32_t)&ADC->RESULT.reg &&
+         descriptor->DSTADDR.reg == (uint32_t)end;
+}
+#endif
+
+#ifdef __SAMD51__
+// Wait for synchronization of the given ADC0 registers between the clock domains
+static inline void syncAdc0(uint32_t registers) {
+#ifdef TZ_WITH_STATS
+  uint32_t spins = 0;
+  while (ADC0->SYNCBUSY.reg & registers) {
+    spins++;
   }
+  addSyncSpins(spins);
+#else
+  while (ADC0->SYNCBUSY.reg & registers);
+#endif
+}
+#else
+// Wait for synchronization of registers between the clock domains
+static inline void syncAdc() {
+  TemperatureZeroAdc::sync();
 }
 #endif
 
+#ifndef __SAMD51__
 
 // Convert raw 12 bit adc reading into temperature float.
 // uses factory calibration data and, only when set and enabled, user calibration data
+// Both are folded into the coefficients by updateCoefficients(), leaving two multiply-adds per reading
 float TemperatureZero::raw2temp (uint16_t adcReading) {
-  // Get course temperature first, in order to estimate the internal 1V reference voltage level at this temperature
-  float meaurementVoltage = ((float)adcReading)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
-  float coarse_temp = _roomTemperature + (((_hotTemperature - _roomTemperature)/(_hotVoltageCompensated - _roomVoltageCompensated)) * (meaurementVoltage - _roomVoltageCompensated));
-  // Estimate the reference voltage using the course temperature
-  float ref1VAtMeasurement = _roomInt1vRef + (((_hotInt1vRef - _roomInt1vRef) * (coarse_temp - _roomTemperature))/(_hotTemperature - _roomTemperature));
-  // Now first compensate the raw adc reading using the estimation of the 1V reference output at current temperature 
-  float measureVoltageCompensated = ((float)adcReading * ref1VAtMeasurement)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
-  // Repeat the temperature interpolation using the compensated measurement voltage
-  float refinedTemp = _roomTemperature + (((_hotTemperature - _roomTemperature)/(_hotVoltageCompensated - _roomVoltageCompensated)) * (measureVoltageCompensated - _roomVoltageCompensated));
-  float result = refinedTemp;
-  if (_isUserCalEnabled) {
-    result = (refinedTemp - _userCalOffsetCorrection) * _userCalGainCorrection;
+  ensureCalibration();
+  float result = TemperatureZeroMath::raw2temp(_conversion, (float)adcReading);
+  if (_isUserCalPiecewise) {
+    result = applyUserCalibrationPoints(result);
   }
   #ifdef TZ_WITH_DEBUG_CODE
-  if (_debug) {
-    _debugSerial->println(F("\n+++ Temperature calculation:"));
-    _debugSerial->print(F("raw adc reading : "));
-    _debugSerial->println(adcReading);
-    _debugSerial->print(F("Course temperature : "));
-    _debugSerial->println(coarse_temp, 1);
-    _debugSerial->print(F("Estimated 1V ref @Course temperature : "));
-    _debugSerial->println(ref1VAtMeasurement, 4);
-    _debugSerial->print(F("Temperature compensated measurement voltage : "));
-    _debugSerial->println(measureVoltageCompensated, 4);
-    _debugSerial->print(F("Refined temperature : "));
-    _debugSerial->println(refinedTemp, 1);
-    _debugSerial->print(F("User calibration post processing is : "));
-    if (_isUserCalEnabled) {
-      _debugSerial->println(F("Enabled"));
-      _debugSerial->print(F("User calibration offset correction : "));
-      _debugSerial->println(_userCalOffsetCorrection, 4);
-      _debugSerial->print(F("User calibration gain correction : "));
-      _debugSerial->println(_userCalGainCorrection, 4);
-      _debugSerial->print(F("User calibration corrected temperature = "));
-      _debugSerial->println(result, 2);
-    } else {
-      _debugSerial->println(F("Disabled"));
+  if (_debug || _isTracing) {
+    // Step through the original two stage interpolation, so the intermediate values can be traced
+    TemperatureZeroSamd21Calibration calibration = TemperatureZeroMath::calibration(readFuses());
+    // Get course temperature first, in order to estimate the internal 1V reference voltage level at this temperature
+    float meaurementVoltage = ((float)adcReading)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+    float coarse_temp = calibration.roomTemperature + (((calibration.hotTemperature - calibration.roomTemperature)/(calibration.hotVoltageCompensated - calibration.roomVoltageCompensated)) * (meaurementVoltage - calibration.roomVoltageCompensated));
+    // Estimate the reference voltage using the course temperature
+    float ref1VAtMeasurement = calibration.roomInt1vRef + (((calibration.hotInt1vRef - calibration.roomInt1vRef) * (coarse_temp - calibration.roomTemperature))/(calibration.hotTemperature - calibration.roomTemperature));
+    // Now first compensate the raw adc reading using the estimation of the 1V reference output at current temperature 
+    float measureVoltageCompensated = ((float)adcReading * ref1VAtMeasurement)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+    // Repeat the temperature interpolation using the compensated measurement voltage
+    float refinedTemp = calibration.roomTemperature + (((calibration.hotTemperature - calibration.roomTemperature)/(calibration.hotVoltageCompensated - calibration.roomVoltageCompensated)) * (measureVoltageCompensated - calibration.roomVoltageCompensated));
+    TemperatureZeroTraceRecord &record = addTraceRecord(TZ_TRACE_CONVERSION);
+    record.raw[0] = adcReading;
+    record.values[0] = coarse_temp;
+    record.values[1] = ref1VAtMeasurement;
+    record.values[2] = measureVoltageCompensated;
+    record.values[3] = refinedTemp;
+    record.values[4] = result;
+    if (_debug) {
+      printTraceRecord(*_debugSerial, record);
     }
   }
 #endif  
@@ -78,66 +156,352 @@ float TemperatureZero::raw2temp (uint16_t adcReading) {
 }
 
 
-#ifdef __SAMD51__ // M4
-float TemperatureZero::raw2temp(uint16_t TP, uint16_t TC) {
-    uint32_t TLI = (*(uint32_t *)FUSES_ROOM_TEMP_VAL_INT_ADDR & FUSES_ROOM_TEMP_VAL_INT_Msk) >> FUSES_ROOM_TEMP_VAL_INT_Pos;
-    uint32_t TLD = (*(uint32_t *)FUSES_ROOM_TEMP_VAL_DEC_ADDR & FUSES_ROOM_TEMP_VAL_DEC_Msk) >> FUSES_ROOM_TEMP_VAL_DEC_Pos;
-    float TL = TLI + convert_dec_to_frac(TLD);
+// Convert an array of raw 12 bit adc readings, e.g. from the continuous sampling buffer
+// Gives the same results as raw2temp() per reading
+void TemperatureZero::raw2temp(const uint16_t *adcReadings, float *temperatures, size_t count) {
+  ensureCalibration();
+  TemperatureZeroMath::raw2temp(_conversion, adcReadings, temperatures, count);
+  if (_isUserCalPiecewise) {
+    for (size_t i = 0; i < count; i++) {
+      temperatures[i] = applyUserCalibrationPoints(temperatures[i]);
+    }
+  }
+}
 
-    uint32_t THI = (*(uint32_t *)FUSES_HOT_TEMP_VAL_INT_ADDR & FUSES_HOT_TEMP_VAL_INT_Msk) >> FUSES_HOT_TEMP_VAL_INT_Pos;
-    uint32_t THD = (*(uint32_t *)FUSES_HOT_TEMP_VAL_DEC_ADDR & FUSES_HOT_TEMP_VAL_DEC_Msk) >> FUSES_HOT_TEMP_VAL_DEC_Pos;
-    float TH = THI + convert_dec_to_frac(THD);
 
-    uint16_t VPL = (*(uint32_t *)FUSES_ROOM_ADC_VAL_PTAT_ADDR & FUSES_ROOM_ADC_VAL_PTAT_Msk) >> FUSES_ROOM_ADC_VAL_PTAT_Pos;
-    uint16_t VPH = (*(uint32_t *)FUSES_HOT_ADC_VAL_PTAT_ADDR & FUSES_HOT_ADC_VAL_PTAT_Msk) >> FUSES_HOT_ADC_VAL_PTAT_Pos;
+// Convert a reading of readInternalTemperatureOversampled() with extraBits beyond 12 bits
+// The fraction below one 12 bit adc step is kept, instead of rounding to the nearest step.
+float TemperatureZero::raw2temp(uint32_t oversampledReading, uint8_t extraBits) {
+  ensureCalibration();
+  float result = TemperatureZeroMath::raw2temp(_conversion, oversampledReading, extraBits);
+  return _isUserCalPiecewise ? applyUserCalibrationPoints(result) : result;
+}
+
 
-    uint16_t VCL = (*(uint32_t *)FUSES_ROOM_ADC_VAL_CTAT_ADDR & FUSES_ROOM_ADC_VAL_CTAT_Msk) >> FUSES_ROOM_ADC_VAL_CTAT_Pos;
-    uint16_t VCH = (*(uint32_t *)FUSES_HOT_ADC_VAL_CTAT_ADDR & FUSES_HOT_ADC_VAL_CTAT_Msk) >> FUSES_HOT_ADC_VAL_CTAT_Pos;
+#else // SAMD51
+
+// Convert the raw 12 bit readings of both temperature sensors into temperature float
+// From SAMD51 datasheet: section 45.6.3.1 (page 1327):
+//   T = (TL*VPH*TC - VPL*TH*TC - TL*VCH*TP + TH*VCL*TP) / (VCL*TP - VCH*TP - VPL*TC + VPH*TC)
+// The calibration dependent products are folded into four coefficients by updateCoefficients(),
+// leaving two multiply-adds and a single hardware FPU division per conversion.
+float TemperatureZero::raw2temp(uint16_t TP, uint16_t TC) {
+  ensureCalibration();
+  float result = TemperatureZeroMath::raw2temp(_rational, TP, TC);
+  if (_isUserCalPiecewise) {
+    result = applyUserCalibrationPoints(result);
+  }
+#ifdef TZ_WITH_DEBUG_CODE
+  if (_debug || _isTracing) {
+    TemperatureZeroTraceRecord &record = addTraceRecord(TZ_TRACE_CONVERSION);
+    record.raw[0] = TP;
+    record.raw[1] = TC;
+    record.values[0] = result;
+    if (_debug) {
+      printTraceRecord(*_debugSerial, record);
+    }
+  }
+#endif
+  return result;
+}
 
-    // From SAMD51 datasheet: section 45.6.3.1 (page 1327).
-    return (TL*VPH*TC - VPL*TH*TC - TL*VCH*TP + TH*VCL*TP) / (VCL*TP - VCH*TP - VPL*TC + VPH*TC);
+// Convert arrays of PTAT and CTAT readings, e.g. taken with readInternalTemperatureRaw(ptat, ctat)
+void TemperatureZero::raw2temp(const uint16_t *TP, const uint16_t *TC, float *temperatures, size_t count) {
+  ensureCalibration();
+  TemperatureZeroMath::raw2temp(_rational, TP, TC, temperatures, count);
+  if (_isUserCalPiecewise) {
+    for (size_t i = 0; i < count; i++) {
+      temperatures[i] = applyUserCalibrationPoints(temperatures[i]);
+    }
+  }
 }
 #endif
 
+// Only the storage of setUserCalibrationStorage() is set up here, so it can be set before init()
 TemperatureZero::TemperatureZero() {
+  _userCalPoints = NULL;
+  _userCalPointCapacity = 0;
+  _userCalPointCount = 0;
 }
 
 void TemperatureZero::init() {
+  initState();
+#ifdef TZ_WITH_DEBUG_CODE
+  traceFactoryCalibration();
+#endif
+#ifdef __SAMD51__
+  updateCoefficients();
+#else
+  // A calibration saved for this chip brings its coefficients along, otherwise derive them
+  if (!loadUserCalibration()) {
+    updateCoefficients();
+  }
+#endif
+  wakeup();
+}
+
+#ifndef __SAMD51__
+#define TZ_RETAINED_MAGIC 0x545A5241 // "TZRA"
+#define TZ_CALIBRATION_MAGIC 0x545A4341 // "TZCA"
+
+// Calibration of the last completed initLazy(), for the next one
+static TemperatureZeroCalibrationRecord _retainedCalibration TZ_NOINIT;
+
+// Word wise checksum of the RAM copy, which only has to catch the random content after power up,
+// so it is much cheaper than the CRC-32 of the flash record
+static uint32_t retainedChecksum(const TemperatureZeroCalibrationRecord &record) {
+  const uint32_t *words = (const uint32_t *)&record;
+  uint32_t checksum = TZ_RETAINED_MAGIC;
+  for (size_t i = 0; i < offsetof(TemperatureZeroCalibrationRecord, crc) / sizeof(uint32_t); i++) {
+    checksum = ((checksum << 5) | (checksum >> 27)) ^ words[i];
+  }
+  return checksum;
+}
+#endif
+
+// Like init(), but without any calibration work or waits, for a short time from reset to the first reading
+// The temperature sensor is enabled without waiting, so it settles while the sketch starts up. The fuses
+// are decoded on the first use of the coefficients, by any read, conversion or calibration change. On the
+// SAMD21 the calibration of the previous initLazy() is taken over from RAM when it is still there, which
+// is the case after sleeping, and after a reset as well when TZ_NOINIT places it in a .noinit section.
+void TemperatureZero::initLazy() {
+  initState();
+  _isCalibrationPending = true;
+#ifndef __SAMD51__
+  _isMilliCPending = true;
+#endif
+  if (!isSensorEnabled()) {
+    _sensorEnableMicros = micros();
+    _isSensorSettling = true;
+#ifdef __SAMD51__
+    SUPC->VREF.reg |= SUPC_VREF_TSEN | SUPC_VREF_ONDEMAND;
+#else
+    SYSCTRL->VREF.reg |= SYSCTRL_VREF_TSEN;
+#endif
+  }
+}
+
+// The calibration part of init(), by initLazy() on the first use of the coefficients
+void TemperatureZero::completeInit() {
+  _isCalibrationPending = false;
+#ifndef __SAMD51__
+  // Any of the paths below derives the integer coefficients as well
+  _isMilliCPending = false;
+#endif
+#ifdef TZ_WITH_DEBUG_CODE
+  traceFactoryCalibration();
+#endif
+#ifdef __SAMD51__
+  updateCoefficients();
+#else
+  if (isCalibrationRecordValid(_retainedCalibration, TZ_RETAINED_MAGIC) &&
+      _retainedCalibration.crc == retainedChecksum(_retainedCalibration)) {
+    applyCalibrationRecord(_retainedCalibration);
+    return;
+  }
+  if (!loadUserCalibration()) {
+    updateCoefficients();
+  }
+  if (fillCalibrationRecord(_retainedCalibration, TZ_RETAINED_MAGIC)) {
+    _retainedCalibration.crc = retainedChecksum(_retainedCalibration);
+  } else {
+    _retainedCalibration.magic = 0;
+  }
+#endif
+}
+
+#ifndef __SAMD51__
+// Like init(), but only prepares the integer readInternalTemperatureMilliC() and raw2milliC() path
+// Without the float calibration, sketches using only the integer path do not link any float code.
+void TemperatureZero::initMilliC() {
+  initState();
+  updateFixedPointCoefficients(TemperatureZeroMath::fixedQuadratic(readFuses()));
+  wakeup();
+}
+
+// The integer part of completeInit(), for raw2milliC() after initLazy(), so the integer path does not
+// link the float calibration. The fixed point coefficients are taken from the RAM copy or the saved
+// record, unless it has calibration points, as their segments are derived with float math. The fuses
+// are decoded otherwise. A later float use still runs completeInit(), which derives all coefficients.
+void TemperatureZero::completeInitMilliC() {
+  _isMilliCPending = false;
+  const TemperatureZeroCalibrationRecord *record = &_retainedCalibration;
+  if (!isCalibrationRecordValid(*record, TZ_RETAINED_MAGIC) || record->crc != retainedChecksum(*record)) {
+    record = (const TemperatureZeroCalibrationRecord *)calibrationRow();
+    if (!isCalibrationRecordValid(*record, TZ_CALIBRATION_MAGIC) || record->crc != calibrationCrc(*record)) {
+      record = NULL;
+    }
+  }
+  if (record == NULL || record->userCalPointCount != 0) {
+    updateFixedPointCoefficients(TemperatureZeroMath::fixedQuadratic(readFuses()));
+    return;
+  }
+  _userCalGainCorrectionQ16 = record->userCalGainCorrectionQ16;
+  _userCalOffsetCorrectionMilliC = record->userCalOffsetCorrectionMilliC;
+  _isUserCalEnabled = record->isUserCalEnabled;
+  updateFixedPointCoefficients(record->factoryMilliC);
+}
+#endif
+
+void TemperatureZero::initState() {
 #ifdef TZ_WITH_DEBUG_CODE
   _debug = false;
+  _isTracing = false;
+  _traceNext = 0;
+  _traceCount = 0;
 #endif
   _averaging = TZ_AVERAGING_64; // on 48Mhz takes approx 26 ms
+#ifndef __SAMD51__
+  _bandgapVoltage = TZ_BANDGAP_VOLTAGE;
+#endif
+  _adaptive = NULL;
   _isUserCalEnabled = false;
-  getFactoryCalibration();
-  wakeup();
+  _isUserCalPiecewise = false;
+  _userCalPointCount = 0;
+  _isCalibrationPending = false;
+#ifndef __SAMD51__
+  _isMilliCPending = false;
+#endif
+  _powerPolicy = TZ_POWER_ALWAYS_ON;
+  _powerIdleMillis = 0;
+  _isSensorSettling = false;
+  _sensorEnableMicros = 0;
+  _lastUseMillis = 0;
+  _lastTemperature = 0;
+  _lastReadingMillis = 0;
+  _coalescingMillis = 0;
+  _readingSequence = 0;
+  _filter = NULL;
+#ifndef __SAMD51__
+  _isRefreshing = false;
+#endif
+#ifndef __SAMD51__
+  _userCalGainCorrectionQ16 = 0x10000;
+  _userCalOffsetCorrectionMilliC = 0;
+  _conversionState = TZ_CONVERSION_IDLE;
+  _conversionResult = 0;
+  _conversionCallback = NULL;
+  _isSessionActive = false;
+  _lookupTable = NULL;
+  _lookupStrideShift = 0;
+  // The shared buffer and alarm are left alone while this instance runs them
+  if (_activeContinuous != this) {
+    if (_bufferOwner == this) {
+      _bufferOwner = NULL;
+    }
+    if (_alarmOwner == this) {
+      _alarmOwner = NULL;
+      _isAlarmArmed = false;
+    }
+  }
+#endif
 }
 
 
 // After sleeping, the temperature sensor seems disabled. So, let's re-enable it.
+// Nothing is done while it is still enabled, so the reads call this themselves, see setPowerPolicy().
 void TemperatureZero::wakeup() {
-
-  SYSCTRL->VREF.reg |= SYSCTRL_VREF_TSEN; // Enable the temperature sensor  
-  while( ADC->STATUS.bit.SYNCBUSY == 1 ); // Wait for synchronization of registers between the clock domains
+  if (isSensorEnabled()) {
+    return;
+  }
+  _sensorEnableMicros = micros();
+  _isSensorSettling = true;
 
   #ifdef __SAMD51__
   SUPC->VREF.reg |= SUPC_VREF_TSEN | SUPC_VREF_ONDEMAND; // Enable the temperature sensor  
   while( ADC0->SYNCBUSY.reg == 1 ); // Wait for synchronization of registers between the clock domains
+  #else
+  SYSCTRL->VREF.reg |= SYSCTRL_VREF_TSEN; // Enable the temperature sensor  
+  syncAdc(); // Wait for synchronization of registers between the clock domains
   #endif
 }
 
 
 
 void TemperatureZero::disable() {
-
-  SYSCTRL->VREF.reg &= ~SYSCTRL_VREF_TSEN; // Disable the temperature sensor  
-  while( ADC->STATUS.bit.SYNCBUSY == 1 );  // Wait for synchronization of registers between the clock domains
+  if (!isSensorEnabled()) {
+    return;
+  }
 
   #ifdef __SAMD51__
-  SUPC->VREF.reg &= ~SUPC_VREF_TSEN | SUPC_VREF_ONDEMAND; // Disable the temperature sensor  
+  SUPC->VREF.reg &= ~(SUPC_VREF_TSEN | SUPC_VREF_ONDEMAND); // Disable the temperature sensor  
   while( ADC0->SYNCBUSY.reg == 1 ); // Wait for synchronization of registers between the clock domains
+  #else
+  SYSCTRL->VREF.reg &= ~SYSCTRL_VREF_TSEN; // Disable the temperature sensor  
+  syncAdc();  // Wait for synchronization of registers between the clock domains
   #endif
 }
 
+// Whether the temperature sensor is enabled, read from the register, so sleep modes are accounted for
+bool TemperatureZero::isSensorEnabled() {
+#ifdef __SAMD51__
+  return SUPC->VREF.bit.TSEN;
+#else
+  return SYSCTRL->VREF.bit.TSEN;
+#endif
+}
+
+// Choose when the temperature sensor is powered, TZ_POWER_ALWAYS_ON by default
+// With TZ_POWER_ON_DEMAND each read enables the sensor, waits TZ_SENSOR_SETTLING_MICROS and disables it
+// again, which saves the most energy for readings far apart. With TZ_POWER_AUTO_OFF the sensor stays
+// enabled between reads until servicePower() finds it idle for idleMillis, so a burst of reads only
+// settles once. Sessions, non-blocking conversions and buffers keep the sensor enabled until they end.
+void TemperatureZero::setPowerPolicy(uint8_t policy, uint16_t idleMillis) {
+  _powerPolicy = policy;
+  _powerIdleMillis = idleMillis;
+  _lastUseMillis = millis();
+  if (policy == TZ_POWER_ALWAYS_ON) {
+    wakeup();
+  } else {
+    servicePower();
+  }
+}
+
+uint8_t TemperatureZero::getPowerPolicy() {
+  return _powerPolicy;
+}
+
+// Disable the sensor when the power policy allows it, call this from loop() or before sleeping
+// With TZ_POWER_AUTO_OFF that is idleMillis after the last read, with TZ_POWER_ON_DEMAND right away,
+// e.g. after a non-blocking conversion completed.
+void TemperatureZero::servicePower() {
+  if (_powerPolicy == TZ_POWER_ALWAYS_ON || isSensorInUse()) {
+    return;
+  }
+  if (_powerPolicy == TZ_POWER_ON_DEMAND || millis() - _lastUseMillis >= _powerIdleMillis) {
+    disable();
+  }
+}
+
+// Enable the sensor for a conversion, and let it settle when it was enabled just now
+void TemperatureZero::powerUp() {
+  wakeup();
+  if (_isSensorSettling) {
+    uint32_t elapsed = micros() - _sensorEnableMicros;
+    if (elapsed < TZ_SENSOR_SETTLING_MICROS) {
+      delayMicroseconds(TZ_SENSOR_SETTLING_MICROS - elapsed);
+    }
+    _isSensorSettling = false;
+  }
+}
+
+// Done with the sensor for now, release it as the power policy says
+void TemperatureZero::powerDown() {
+  _lastUseMillis = millis();
+  if (_powerPolicy == TZ_POWER_ON_DEMAND && !isSensorInUse()) {
+    disable();
+  }
+}
+
+// Whether a session, a non-blocking conversion or a buffer still needs the sensor
+bool TemperatureZero::isSensorInUse() {
+#ifdef __SAMD51__
+  return false;
+#else
+  return _isSessionActive || _activeConversion == this || _activeContinuous == this;
+#endif
+}
+
 
 // Set the sample averaging as the internal sensor is somewhat noisy
 // Default value is TZ_AVERAGING_64 which takes approx 26 ms at 48 Mhz clock
@@ -145,17 +509,357 @@ void TemperatureZero::setAveraging(uint8_t averaging) {
   _averaging = averaging;
 }
 
+uint8_t TemperatureZero::getAveraging() {
+  return _averaging;
+}
+
+#define TZ_ADAPTIVE_WINDOW 8
+
+// Let readInternalTemperature() pick the averaging itself, starting from the current setting
+// The noise is estimated from the differences between successive readings, which leaves out a
+// slowly changing temperature. After every TZ_ADAPTIVE_WINDOW readings the averaging is doubled
+// when the noise variance (in degrees squared) is above targetVariance, and halved when even half
+// the averaging would stay well below it. With maxReadMicros, a read is never allowed to take longer.
+// Pass 0 for either limit to leave it out, e.g. enableAdaptiveAveraging(adaptive, 0, 5000) for the lowest
+// noise within 5 ms per read. The noise estimate is kept in adaptive, which must stay valid until
+// disableAdaptiveAveraging() or the next init().
+void TemperatureZero::enableAdaptiveAveraging(TemperatureZeroAdaptive &adaptive, float targetVariance,
+                                              uint32_t maxReadMicros) {
+  adaptive.targetVariance = targetVariance;
+  adaptive.maxReadMicros = maxReadMicros;
+  adaptive.previous = 0;
+  adaptive.noise = 0;
+  adaptive.count = 0;
+  _adaptive = &adaptive;
+}
+
+// Keep the averaging at its current setting again
+void TemperatureZero::disableAdaptiveAveraging() {
+  _adaptive = NULL;
+}
+
+// Update the noise estimate with a new reading, and step the averaging when needed
+void TemperatureZero::adaptAveraging(float temperature, uint32_t readMicros) {
+  TemperatureZeroAdaptive &adaptive = *_adaptive;
+  bool isTooSlow = adaptive.maxReadMicros != 0 && readMicros > adaptive.maxReadMicros;
+  // Doubling the averaging about doubles the time of a read
+  bool canDouble = _averaging < TZ_AVERAGING_256 && (adaptive.maxReadMicros == 0 || 2 * readMicros <= adaptive.maxReadMicros);
+  if (isTooSlow && _averaging > TZ_AVERAGING_1) {
+    _averaging--;
+    adaptive.count = 0;
+    return;
+  }
+  if (adaptive.count > 0) {
+    // The variance of the difference of two readings is twice the variance of a reading
+    float difference = temperature - adaptive.previous;
+    adaptive.noise += difference * difference * 0.5f;
+  }
+  adaptive.previous = temperature;
+  if (++adaptive.count <= TZ_ADAPTIVE_WINDOW) {
+    return;
+  }
+  float noise = adaptive.noise / TZ_ADAPTIVE_WINDOW;
+  adaptive.noise = 0;
+  adaptive.count = 0;
+  if (adaptive.targetVariance == 0 || noise > adaptive.targetVariance) {
+    if (canDouble) {
+      _averaging++;
+    }
+  } else if (4 * noise < adaptive.targetVariance && _averaging > TZ_AVERAGING_1) {
+    // Halving the averaging doubles the noise, which then is still below half the target
+    _averaging--;
+  }
+}
+
+// AVGCTRL register value for the hardware averaging selected by setAveraging()
+// The register layout is the same on SAMD21 and SAMD51.
+uint8_t TemperatureZero::averagingControl() {
+  switch(_averaging) {
+    case TZ_AVERAGING_1: 
+      return 0;
+    case TZ_AVERAGING_2: 
+      return ADC_AVGCTRL_SAMPLENUM_2 | ADC_AVGCTRL_ADJRES(0x1);
+    case TZ_AVERAGING_4: 
+      return ADC_AVGCTRL_SAMPLENUM_4 | ADC_AVGCTRL_ADJRES(0x2);
+    case TZ_AVERAGING_8: 
+      return ADC_AVGCTRL_SAMPLENUM_8 | ADC_AVGCTRL_ADJRES(0x3);
+    case TZ_AVERAGING_16: 
+      return ADC_AVGCTRL_SAMPLENUM_16 | ADC_AVGCTRL_ADJRES(0x4);
+    case TZ_AVERAGING_32: 
+      return ADC_AVGCTRL_SAMPLENUM_32 | ADC_AVGCTRL_ADJRES(0x4);
+    case TZ_AVERAGING_64: 
+      return ADC_AVGCTRL_SAMPLENUM_64 | ADC_AVGCTRL_ADJRES(0x4);
+    case TZ_AVERAGING_128: 
+      return ADC_AVGCTRL_SAMPLENUM_128 | ADC_AVGCTRL_ADJRES(0x4);
+    case TZ_AVERAGING_256: 
+      return ADC_AVGCTRL_SAMPLENUM_256 | ADC_AVGCTRL_ADJRES(0x4);
+  }
+  return 0;
+}
+
 // Reads temperature using internal ADC channel
 // Datasheet chapter 37.10.8 - Temperature Sensor Characteristics
 float TemperatureZero::readInternalTemperature() {
 
-   uint16_t adcReading = readInternalTemperatureRaw();
-   return raw2temp(adcReading);
+   uint16_t sequence = _readingSequence;
+   float temperature;
+   uint32_t ageMillis;
+   if (_coalescingMillis != 0 && getLastTemperature(temperature, ageMillis) && ageMillis < _coalescingMillis) {
+     return temperature;
+   }
+   lockAdc();
+   if (_coalescingMillis != 0 && _readingSequence != sequence) {
+     // Another task converted while this one waited for the lock, so share its reading
+     temperature = _lastTemperature;
+     unlockAdc();
+     return temperature;
+   }
+   #ifndef __SAMD51__
+   if (_isRefreshing) {
+     // A background conversion of readInternalTemperature(maxAgeMillis, true) is pending, which is
+     // just as recent, so take it over instead of converting again after it
+     temperature = completeRefresh();
+     unlockAdc();
+     return temperature;
+   }
+   #endif
 
+   uint32_t start = _adaptive != NULL ? micros() : 0;
    #ifdef __SAMD51__ // M4
-   return readInternalTemperatureRaw();
+   uint16_t ptat;
+   uint16_t ctat;
+   readInternalTemperatureRaw(ptat, ctat);
+   temperature = raw2temp(ptat, ctat);
+   #else
+   uint16_t adcReading = readTemperatureRaw();
+   temperature = _lookupTable != NULL ? lookupTemperature(adcReading) : raw2temp(adcReading);
    #endif
+   if (_adaptive != NULL) {
+     adaptAveraging(temperature, micros() - start);
+   }
+   if (_filter != NULL) {
+     temperature = _filter->update(temperature);
+   }
+   storeReading(temperature);
+   unlockAdc();
+   return temperature;
+}
+
+// Reads temperature, or returns the last reading when it is at most maxAgeMillis old
+// Die temperature changes slowly, so modules that each want it once per loop can share a reading:
+// only the first call after it got too old converts. With isBackground, that call does not wait on the
+// SAMD21 either: it starts a non-blocking conversion and returns the older reading, and a later call
+// takes over the result. Without any reading yet, or when the ADC is busy, the call waits for a new one.
+float TemperatureZero::readInternalTemperature(uint32_t maxAgeMillis, bool isBackground) {
+  float temperature;
+  uint32_t ageMillis;
+#ifndef __SAMD51__
+  if (_isRefreshing && isConversionReady()) {
+    completeRefresh();
+  }
+#endif
+  bool hasReading = getLastTemperature(temperature, ageMillis);
+  if (hasReading && ageMillis <= maxAgeMillis) {
+    return temperature;
+  }
+#ifndef __SAMD51__
+  if (_isRefreshing) {
+    return isBackground ? temperature : completeRefresh();
+  }
+  if (hasReading && isBackground && startConversion()) {
+    _isRefreshing = true;
+    return temperature;
+  }
+#else
+  (void)isBackground;
+#endif
+  return readInternalTemperature();
+}
+
+// millis() at the last reading of readInternalTemperature(), see getLastTemperature() for its age
+uint32_t TemperatureZero::lastReadingTimestamp() {
+  return _lastReadingMillis;
+}
+
+// Let callers of readInternalTemperature(), e.g. tasks of an RTOS, share conversions
+// A reading younger than windowMillis is returned right away, and callers that waited for the lock of
+// TemperatureZeroAdc::setLockHooks() while another task converted take over that reading. So concurrent
+// readers wait for at most one conversion instead of one each. 0, the default, converts on every call.
+void TemperatureZero::setCoalescingWindow(uint16_t windowMillis) {
+  _coalescingMillis = windowMillis;
+}
+
+// Last reading of readInternalTemperature(), of any caller, and its age in milliseconds
+// Never waits for the ADC. Returns false when there was no reading yet.
+bool TemperatureZero::getLastTemperature(float &temperature, uint32_t &ageMillis) {
+  noInterrupts();
+  uint16_t sequence = _readingSequence;
+  temperature = _lastTemperature;
+  uint32_t readingMillis = _lastReadingMillis;
+  interrupts();
+  ageMillis = millis() - readingMillis;
+  return sequence != 0;
+}
+
+// Keep a reading for getLastTemperature(), consistent for readers in other tasks
+void TemperatureZero::storeReading(float temperature) {
+  noInterrupts();
+  _lastTemperature = temperature;
+  _lastReadingMillis = millis();
+  if (++_readingSequence == 0) {
+    _readingSequence = 1;
+  }
+  interrupts();
+}
+
+// Lock the ADC against other tasks, see TemperatureZeroAdc::setLockHooks()
+// A session holds the lock from beginSession() to endSession() already.
+void TemperatureZero::lockAdc() {
+#ifndef __SAMD51__
+  if (!_isSessionActive) {
+    TemperatureZeroAdc::lock();
+  }
+#endif
+}
+
+void TemperatureZero::unlockAdc() {
+#ifndef __SAMD51__
+  if (!_isSessionActive) {
+    TemperatureZeroAdc::unlock();
+  }
+#endif
+}
+
+// Let readInternalTemperature() return the output of a streaming filter, e.g. a
+// TemperatureFilter<TZ_FILTER_EMA, 64>, instead of the reading itself. Pass NULL to remove it again.
+// Combined with a short averaging like TZ_AVERAGING_4, this gives a smooth reading at a low latency.
+void TemperatureZero::setFilter(TemperatureFilterBase *filter) {
+  _filter = filter;
+  if (_filter != NULL) {
+    _filter->reset();
+  }
+}
+
+#ifndef __SAMD51__
+
+// Let readInternalTemperature() use a lookup table, trading memory for conversion time
+// The caller supplied table needs TZ_LOOKUP_TABLE_SIZE(strideShift) entries, e.g. 4096 floats
+// for a full table, or 257 for one entry every 16 adc steps (strideShift 4) with linear interpolation.
+// The table is filled here, and refilled whenever the user calibration changes.
+// Returns false when the table is too small.
+bool TemperatureZero::enableLookupTable(float *table, uint16_t size, uint8_t strideShift) {
+  ensureCalibration();
+  if (table == NULL || strideShift > 11 || size < TZ_LOOKUP_TABLE_SIZE(strideShift)) {
+    return false;
+  }
+  _lookupTable = table;
+  _lookupStrideShift = strideShift;
+  _lookupFractionScale = 1.0f / (float)(1 << strideShift);
+  buildLookupTable();
+  return true;
+}
+
+void TemperatureZero::disableLookupTable() {
+  _lookupTable = NULL;
+}
+
+// Fill the lookup table from the current coefficients
+void TemperatureZero::buildLookupTable() {
+  uint16_t size = TZ_LOOKUP_TABLE_SIZE(_lookupStrideShift);
+  TemperatureZeroMath::buildLookupTable(_conversion, _lookupTable, size, _lookupStrideShift);
+  if (_isUserCalPiecewise) {
+    for (uint16_t i = 0; i < size; i++) {
+      _lookupTable[i] = applyUserCalibrationPoints(_lookupTable[i]);
+    }
+  }
+}
+
+// Convert raw 12 bit adc reading using the lookup table
+float TemperatureZero::lookupTemperature(uint16_t adcReading) {
+  return TemperatureZeroMath::lookupTemperature(_lookupTable, _lookupStrideShift, _lookupFractionScale, adcReading);
+}
+
+// Convert raw 12 bit adc reading into milli degrees, using integer math only
+// Same calibration as raw2temp(), rounded to 1 milli degree
+int32_t TemperatureZero::raw2milliC(uint16_t adcReading) {
+  ensureMilliC();
+  int32_t milliC = TemperatureZeroMath::raw2milliC(_milliC, adcReading);
+  return _isUserCalPiecewise ? TemperatureZeroMath::applyCalibrationPointsMilliC(_userCalPoints, _userCalPointCount, milliC)
+                             : milliC;
+}
+
+// Reads temperature in milli degrees, using integer math only
+int32_t TemperatureZero::readInternalTemperatureMilliC() {
+  return raw2milliC(readInternalTemperatureRaw());
+}
+
+// Convert a reading of readCompensatedRaw() into temperature float
+// The bandgap is measured at half gain against the 1V reference, so the actual reference voltage is
+//   ref1V = bandgapVoltage * 4095 / (2 * bandgapReading)
+// which replaces the estimate from the coarse temperature, leaving a single interpolation:
+//   refined = Troom + S * (adcReading * ref1V / 4095 - Vroom)
+// Only the reading ratio remains per conversion, as the constants are folded by updateCoefficients().
+float TemperatureZero::raw2tempCompensated(uint16_t adcReading, uint16_t bandgapReading) {
+  ensureCalibration();
+  if (bandgapReading == 0) {
+    return raw2temp(adcReading);
+  }
+  if (_bandgapVoltage == 0) {
+    // Calibrate the bandgap once, at the temperature of this reading, see TemperatureZeroMath::bandgapVoltage()
+    _bandgapVoltage = TemperatureZeroMath::bandgapVoltage(TemperatureZeroMath::calibration(readFuses()),
+                                                          adcReading, bandgapReading);
+    updateCoefficients();
+  }
+  float result = TemperatureZeroMath::raw2temp(_compensated, (float)adcReading / (float)bandgapReading);
+  return _isUserCalPiecewise ? applyUserCalibrationPoints(result) : result;
+}
+
+// Reads temperature, compensated by a measurement of the 1V reference instead of its estimate
+// Takes an extra bandgap conversion, so it takes about twice as long as readInternalTemperature().
+// The accuracy depends on the bandgap voltage, which is calibrated on the first compensated reading
+// unless set with setBandgapVoltage(). Measure it once per board for best results.
+float TemperatureZero::readInternalTemperatureCompensated() {
+  uint16_t adcReading;
+  uint16_t bandgapReading;
+  readCompensatedRaw(adcReading, bandgapReading);
+  return raw2tempCompensated(adcReading, bandgapReading);
+}
+
+// Set the voltage of the bandgap reference, TZ_BANDGAP_VOLTAGE by default
+// 0 calibrates it again on the next compensated reading, against the 1V reference estimate of the fuses.
+void TemperatureZero::setBandgapVoltage(float bandgapVoltage) {
+  ensureCalibration();
+  _bandgapVoltage = bandgapVoltage;
+  updateCoefficients();
 }
+#endif
+
+#ifdef TZ_WITH_STATS
+// Get a copy of the counters, consistent even when an interrupt updates them meanwhile
+// The counters are shared by all instances, just like the ADC.
+TemperatureZeroStats TemperatureZero::getStats() {
+  noInterrupts();
+  TemperatureZeroStats stats = _stats;
+#ifndef __SAMD51__
+  stats.syncWaits = TemperatureZeroAdc::_syncWaits;
+  stats.syncSpins = TemperatureZeroAdc::_syncSpins;
+  stats.maxSyncSpins = TemperatureZeroAdc::_maxSyncSpins;
+#endif
+  interrupts();
+  return stats;
+}
+
+void TemperatureZero::resetStats() {
+  noInterrupts();
+  memset(&_stats, 0, sizeof(_stats));
+#ifndef __SAMD51__
+  TemperatureZeroAdc::_syncWaits = 0;
+  TemperatureZeroAdc::_syncSpins = 0;
+  TemperatureZeroAdc::_maxSyncSpins = 0;
+#endif
+  interrupts();
+}
+#endif
 
 #ifdef TZ_WITH_DEBUG_CODE
 // To follow along, the detailed temperature calculation, enable library debugging
@@ -168,87 +872,210 @@ void TemperatureZero::enableDebugging(Stream &debugPort) {
 void TemperatureZero::disableDebugging(void) {
   _debug = false;
 }
-#endif
 
-#define INT1V_DIVIDER_1000                1000.0
-#define ADC_12BIT_FULL_SCALE_VALUE_FLOAT  4095.0
+// Record the intermediate values of every conversion in the trace, instead of printing them
+// Unlike enableDebugging(), this hardly changes the timing. Print the records later with dumpTrace().
+void TemperatureZero::enableTrace() {
+  _isTracing = true;
+}
+
+void TemperatureZero::disableTrace() {
+  _isTracing = false;
+}
+
+void TemperatureZero::clearTrace() {
+  _traceNext = 0;
+  _traceCount = 0;
+}
+
+// Print the traced records, oldest first, in the format of enableDebugging()
+void TemperatureZero::dumpTrace(Stream &debugPort) {
+  uint8_t index = (_traceNext + TZ_TRACE_LENGTH - _traceCount) % TZ_TRACE_LENGTH;
+  for (uint8_t i = 0; i < _traceCount; i++) {
+    printTraceRecord(debugPort, _trace[index]);
+    index = (index + 1) % TZ_TRACE_LENGTH;
+  }
+}
+
+// Take the next record of the trace ring buffer
+TemperatureZeroTraceRecord &TemperatureZero::addTraceRecord(uint8_t kind) {
+  TemperatureZeroTraceRecord &record = _trace[_traceNext];
+  _traceNext = (_traceNext + 1) % TZ_TRACE_LENGTH;
+  if (_traceCount < TZ_TRACE_LENGTH) {
+    _traceCount++;
+  }
+  record.kind = kind;
+  record.isUserCalEnabled = _isUserCalEnabled;
+  return record;
+}
 
+void TemperatureZero::printTraceRecord(Stream &debugPort, const TemperatureZeroTraceRecord &record) {
+#ifdef __SAMD51__
+  if (record.kind == TZ_TRACE_CALIBRATION) {
+    debugPort.println(F("\n+++ Factory calibration parameters:"));
+    debugPort.print(F("Room / Hot Temperature : "));
+    debugPort.print(record.values[0], 1);
+    debugPort.print(F(" / "));
+    debugPort.println(record.values[1], 1);
+    debugPort.print(F("Room / Hot PTAT Reading : "));
+    debugPort.print(record.values[2], 0);
+    debugPort.print(F(" / "));
+    debugPort.println(record.values[3], 0);
+    debugPort.print(F("Room / Hot CTAT Reading : "));
+    debugPort.print(record.values[4], 0);
+    debugPort.print(F(" / "));
+    debugPort.println(record.values[5], 0);
+  } else {
+    debugPort.println(F("\n+++ Temperature calculation:"));
+    debugPort.print(F("PTAT / CTAT reading : "));
+    debugPort.print(record.raw[0]);
+    debugPort.print(F(" / "));
+    debugPort.println(record.raw[1]);
+    debugPort.print(F("Temperature : "));
+    debugPort.println(record.values[0], 2);
+  }
+#else
+  if (record.kind == TZ_TRACE_CALIBRATION) {
+    debugPort.println(F("\n+++ Factory calibration parameters:"));
+    debugPort.print(F("Room Temperature : "));
+    debugPort.println(record.values[0], 1);
+    debugPort.print(F("Hot Temperature  : "));
+    debugPort.println(record.values[1], 1);
+    debugPort.print(F("Room Reading     : "));
+    debugPort.println(record.raw[0]);
+    debugPort.print(F("Hot Reading      : "));
+    debugPort.println(record.raw[1]);
+    debugPort.print(F("Room Voltage ref : "));
+    debugPort.println(record.values[2], 4);
+    debugPort.print(F("Hot Voltage ref  : "));
+    debugPort.println(record.values[3], 4);
+    debugPort.print(F("Room Reading compensated : "));
+    debugPort.println(record.values[4], 4);
+    debugPort.print(F("Hot Reading compensated  : "));
+    debugPort.println(record.values[5], 4);
+  } else {
+    debugPort.println(F("\n+++ Temperature calculation:"));
+    debugPort.print(F("raw adc reading : "));
+    debugPort.println(record.raw[0]);
+    debugPort.print(F("Course temperature : "));
+    debugPort.println(record.values[0], 1);
+    debugPort.print(F("Estimated 1V ref @Course temperature : "));
+    debugPort.println(record.values[1], 4);
+    debugPort.print(F("Temperature compensated measurement voltage : "));
+    debugPort.println(record.values[2], 4);
+    debugPort.print(F("Refined temperature : "));
+    debugPort.println(record.values[3], 1);
+    debugPort.print(F("User calibration post processing is : "));
+    if (record.isUserCalEnabled) {
+      debugPort.println(F("Enabled"));
+      debugPort.print(F("User calibration corrected temperature = "));
+      debugPort.println(record.values[4], 2);
+    } else {
+      debugPort.println(F("Disabled"));
+    }
+  }
+#endif
+}
+#endif
 
-// Get all factory calibration parameters and process them
+#ifdef TZ_WITH_DEBUG_CODE
+// Trace the factory calibration, which is not kept, as only the coefficients derived from it are needed
 // This includes both the temperature sensor calibration as well as the 1v reference calibration
-void TemperatureZero::getFactoryCalibration() {
+void TemperatureZero::traceFactoryCalibration() {
+  // Always traced, so dumpTrace() can show the calibration init() started with
+  TemperatureZeroTraceRecord &record = addTraceRecord(TZ_TRACE_CALIBRATION);
+  TemperatureZeroCalibration calibration = TemperatureZeroMath::calibration(readFuses());
+#ifdef __SAMD51__
+  record.values[0] = calibration.roomTemperature;
+  record.values[1] = calibration.hotTemperature;
+  record.values[2] = calibration.roomPtat;
+  record.values[3] = calibration.hotPtat;
+  record.values[4] = calibration.roomCtat;
+  record.values[5] = calibration.hotCtat;
+#else
+  record.raw[0] = calibration.roomReading;
+  record.raw[1] = calibration.hotReading;
+  record.values[0] = calibration.roomTemperature;
+  record.values[1] = calibration.hotTemperature;
+  record.values[2] = calibration.roomInt1vRef;
+  record.values[3] = calibration.hotInt1vRef;
+  record.values[4] = calibration.roomVoltageCompensated;
+  record.values[5] = calibration.hotVoltageCompensated;
+#endif
+  if (_debug) {
+    printTraceRecord(*_debugSerial, record);
+  }
+}
+#endif
 
+#ifdef __SAMD51__
+// Factory room and hot temperature readings of both the PTAT and CTAT sensors
+TemperatureZeroSamd51Fuses TemperatureZero::readFuses() {
+  TemperatureZeroSamd51Fuses fuses;
+  fuses.roomInteger = (*(uint32_t *)FUSES_ROOM_TEMP_VAL_INT_ADDR & FUSES_ROOM_TEMP_VAL_INT_Msk) >> FUSES_ROOM_TEMP_VAL_INT_Pos;
+  fuses.roomDecimal = (*(uint32_t *)FUSES_ROOM_TEMP_VAL_DEC_ADDR & FUSES_ROOM_TEMP_VAL_DEC_Msk) >> FUSES_ROOM_TEMP_VAL_DEC_Pos;
+  fuses.hotInteger = (*(uint32_t *)FUSES_HOT_TEMP_VAL_INT_ADDR & FUSES_HOT_TEMP_VAL_INT_Msk) >> FUSES_HOT_TEMP_VAL_INT_Pos;
+  fuses.hotDecimal = (*(uint32_t *)FUSES_HOT_TEMP_VAL_DEC_ADDR & FUSES_HOT_TEMP_VAL_DEC_Msk) >> FUSES_HOT_TEMP_VAL_DEC_Pos;
+  fuses.roomPtat = (*(uint32_t *)FUSES_ROOM_ADC_VAL_PTAT_ADDR & FUSES_ROOM_ADC_VAL_PTAT_Msk) >> FUSES_ROOM_ADC_VAL_PTAT_Pos;
+  fuses.hotPtat = (*(uint32_t *)FUSES_HOT_ADC_VAL_PTAT_ADDR & FUSES_HOT_ADC_VAL_PTAT_Msk) >> FUSES_HOT_ADC_VAL_PTAT_Pos;
+  fuses.roomCtat = (*(uint32_t *)FUSES_ROOM_ADC_VAL_CTAT_ADDR & FUSES_ROOM_ADC_VAL_CTAT_Msk) >> FUSES_ROOM_ADC_VAL_CTAT_Pos;
+  fuses.hotCtat = (*(uint32_t *)FUSES_HOT_ADC_VAL_CTAT_ADDR & FUSES_HOT_ADC_VAL_CTAT_Msk) >> FUSES_HOT_ADC_VAL_CTAT_Pos;
+  return fuses;
+}
+#else
+// Factory calibration fields of the temperature log
+TemperatureZeroSamd21Fuses TemperatureZero::readFuses() {
+  TemperatureZeroSamd21Fuses fuses;
    // Factory room temperature readings
-  uint8_t roomInteger = (*(uint32_t*)FUSES_ROOM_TEMP_VAL_INT_ADDR & FUSES_ROOM_TEMP_VAL_INT_Msk) >> FUSES_ROOM_TEMP_VAL_INT_Pos;
-  uint8_t roomDecimal = (*(uint32_t*)FUSES_ROOM_TEMP_VAL_DEC_ADDR & FUSES_ROOM_TEMP_VAL_DEC_Msk) >> FUSES_ROOM_TEMP_VAL_DEC_Pos;
-  _roomTemperature = roomInteger + convertDecToFrac(roomDecimal);
-  _roomReading = ((*(uint32_t*)FUSES_ROOM_ADC_VAL_ADDR & FUSES_ROOM_ADC_VAL_Msk) >> FUSES_ROOM_ADC_VAL_Pos);
+  fuses.roomInteger = (*(uint32_t*)FUSES_ROOM_TEMP_VAL_INT_ADDR & FUSES_ROOM_TEMP_VAL_INT_Msk) >> FUSES_ROOM_TEMP_VAL_INT_Pos;
+  fuses.roomDecimal = (*(uint32_t*)FUSES_ROOM_TEMP_VAL_DEC_ADDR & FUSES_ROOM_TEMP_VAL_DEC_Msk) >> FUSES_ROOM_TEMP_VAL_DEC_Pos;
+  fuses.roomReading = ((*(uint32_t*)FUSES_ROOM_ADC_VAL_ADDR & FUSES_ROOM_ADC_VAL_Msk) >> FUSES_ROOM_ADC_VAL_Pos);
    // Factory hot temperature readings
-  uint8_t hotInteger = (*(uint32_t*)FUSES_HOT_TEMP_VAL_INT_ADDR & FUSES_HOT_TEMP_VAL_INT_Msk) >> FUSES_HOT_TEMP_VAL_INT_Pos;
-  uint8_t hotDecimal = (*(uint32_t*)FUSES_HOT_TEMP_VAL_DEC_ADDR & FUSES_HOT_TEMP_VAL_DEC_Msk) >> FUSES_HOT_TEMP_VAL_DEC_Pos;
-  _hotTemperature = hotInteger + convertDecToFrac(hotDecimal);
-  _hotReading = ((*(uint32_t*)FUSES_HOT_ADC_VAL_ADDR & FUSES_HOT_ADC_VAL_Msk) >> FUSES_HOT_ADC_VAL_Pos);
+  fuses.hotInteger = (*(uint32_t*)FUSES_HOT_TEMP_VAL_INT_ADDR & FUSES_HOT_TEMP_VAL_INT_Msk) >> FUSES_HOT_TEMP_VAL_INT_Pos;
+  fuses.hotDecimal = (*(uint32_t*)FUSES_HOT_TEMP_VAL_DEC_ADDR & FUSES_HOT_TEMP_VAL_DEC_Msk) >> FUSES_HOT_TEMP_VAL_DEC_Pos;
+  fuses.hotReading = ((*(uint32_t*)FUSES_HOT_ADC_VAL_ADDR & FUSES_HOT_ADC_VAL_Msk) >> FUSES_HOT_ADC_VAL_Pos);
   // Factory internal 1V voltage reference readings at both room and hot temperatures
-  int8_t roomInt1vRefRaw = (int8_t)((*(uint32_t*)FUSES_ROOM_INT1V_VAL_ADDR & FUSES_ROOM_INT1V_VAL_Msk) >> FUSES_ROOM_INT1V_VAL_Pos);
-  int8_t hotInt1vRefRaw  = (int8_t)((*(uint32_t*)FUSES_HOT_INT1V_VAL_ADDR & FUSES_HOT_INT1V_VAL_Msk) >> FUSES_HOT_INT1V_VAL_Pos);
-  _roomInt1vRef = 1 - ((float)roomInt1vRefRaw/INT1V_DIVIDER_1000);
-  _hotInt1vRef  = 1 - ((float)hotInt1vRefRaw/INT1V_DIVIDER_1000);
-  // Combining the temperature dependent 1v reference with the ADC readings
-  _roomVoltageCompensated = ((float)_roomReading * _roomInt1vRef)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
-  _hotVoltageCompensated = ((float)_hotReading * _hotInt1vRef)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
-
-  #ifdef __SAMD51__
-  uint32_t TLI = (*(uint32_t *)FUSES_ROOM_TEMP_VAL_INT_ADDR & FUSES_ROOM_TEMP_VAL_INT_Msk) >> FUSES_ROOM_TEMP_VAL_INT_Pos;
-  uint32_t TLD = (*(uint32_t *)FUSES_ROOM_TEMP_VAL_DEC_ADDR & FUSES_ROOM_TEMP_VAL_DEC_Msk) >> FUSES_ROOM_TEMP_VAL_DEC_Pos;
-  float TL = TLI + convert_dec_to_frac(TLD);
+  fuses.roomInt1vRef = (int8_t)((*(uint32_t*)FUSES_ROOM_INT1V_VAL_ADDR & FUSES_ROOM_INT1V_VAL_Msk) >> FUSES_ROOM_INT1V_VAL_Pos);
+  fuses.hotInt1vRef  = (int8_t)((*(uint32_t*)FUSES_HOT_INT1V_VAL_ADDR & FUSES_HOT_INT1V_VAL_Msk) >> FUSES_HOT_INT1V_VAL_Pos);
+  return fuses;
+}
 
-  uint32_t THI = (*(uint32_t *)FUSES_HOT_TEMP_VAL_INT_ADDR & FUSES_HOT_TEMP_VAL_INT_Msk) >> FUSES_HOT_TEMP_VAL_INT_Pos;
-  uint32_t THD = (*(uint32_t *)FUSES_HOT_TEMP_VAL_DEC_ADDR & FUSES_HOT_TEMP_VAL_DEC_Msk) >> FUSES_HOT_TEMP_VAL_DEC_Pos;
-  float TH = THI + convert_dec_to_frac(THD);
+// Fold the user calibration, when enabled, into the integer path coefficients of the factory calibration
+void TemperatureZero::updateFixedPointCoefficients(const TemperatureZeroFixedQuadratic &factoryMilliC) {
+  _isUserCalPiecewise = _isUserCalEnabled && _userCalPointCount != 0;
+  _milliC = factoryMilliC;
+  if (_isUserCalEnabled && !_isUserCalPiecewise) {
+    TemperatureZeroMath::applyUserCalibration(_milliC, _userCalGainCorrectionQ16, _userCalOffsetCorrectionMilliC);
+  }
+}
 
-  uint16_t VPL = (*(uint32_t *)FUSES_ROOM_ADC_VAL_PTAT_ADDR & FUSES_ROOM_ADC_VAL_PTAT_Msk) >> FUSES_ROOM_ADC_VAL_PTAT_Pos;
-  uint16_t VPH = (*(uint32_t *)FUSES_HOT_ADC_VAL_PTAT_ADDR & FUSES_HOT_ADC_VAL_PTAT_Msk) >> FUSES_HOT_ADC_VAL_PTAT_Pos;
-  uint16_t VCL = (*(uint32_t *)FUSES_ROOM_ADC_VAL_CTAT_ADDR & FUSES_ROOM_ADC_VAL_CTAT_Msk) >> FUSES_ROOM_ADC_VAL_CTAT_Pos;
-  uint16_t VCH = (*(uint32_t *)FUSES_HOT_ADC_VAL_CTAT_ADDR & FUSES_HOT_ADC_VAL_CTAT_Msk) >> FUSES_HOT_ADC_VAL_CTAT_Pos;
+#endif
 
-  #endif
-#ifdef TZ_WITH_DEBUG_CODE
-  if (_debug) {
-    _debugSerial->println(F("\n+++ Factory calibration parameters:"));
-    _debugSerial->print(F("Room Temperature : "));
-    _debugSerial->println(_roomTemperature, 1);
-    _debugSerial->print(F("Hot Temperature  : "));
-    _debugSerial->println(_hotTemperature, 1);
-    _debugSerial->print(F("Room Reading     : "));
-    _debugSerial->println(_roomReading);
-    _debugSerial->print(F("Hot Reading      : "));
-    _debugSerial->println(_hotReading);
-    _debugSerial->print(F("Room Voltage ref raw / interpreted : "));
-    _debugSerial->print(roomInt1vRefRaw);
-    _debugSerial->print(F(" / "));
-    _debugSerial->println(_roomInt1vRef, 4);
-    _debugSerial->print(F("Hot Voltage ref raw / interpreted  : "));
-    _debugSerial->print(hotInt1vRefRaw);
-    _debugSerial->print(F(" / "));
-    _debugSerial->println(_hotInt1vRef, 4);
-    _debugSerial->print(F("Room Reading compensated : "));
-    _debugSerial->println(_roomVoltageCompensated, 4);
-    _debugSerial->print(F("Hot Reading compensated  : "));
-    _debugSerial->println(_hotVoltageCompensated, 4);
-  }
-#endif
-}
-
-
-// Extra safe decimal to fractional conversion
-float TemperatureZero::convertDecToFrac(uint8_t val) {
-  if (val < 10) {
-    return ((float)val/10.0);
-  } else if (val <100) {
-    return ((float)val/100.0);
-  } else {
-    return ((float)val/1000.0);
+// Fold the factory calibration and, when enabled, the user calibration into the coefficients of raw2temp()
+// The factory calibration is read from the fuses again rather than kept in the object, as this only
+// runs when the calibration changes. See TemperatureZeroMath::quadratic() and TemperatureZeroMath::rational()
+// for the derivation.
+void TemperatureZero::updateCoefficients() {
+  _isUserCalPiecewise = _isUserCalEnabled && _userCalPointCount != 0;
+  TemperatureZeroCalibration calibration = TemperatureZeroMath::calibration(readFuses());
+#ifdef __SAMD51__
+  _rational = TemperatureZeroMath::rational(calibration);
+  if (_isUserCalEnabled && !_isUserCalPiecewise) {
+    TemperatureZeroMath::applyUserCalibration(_rational, _userCalGainCorrection, _userCalOffsetCorrection);
+  }
+#else
+  _conversion = TemperatureZeroMath::quadratic(calibration);
+  // With the measured 1V reference, only the refined interpolation remains, see raw2tempCompensated()
+  _compensated = TemperatureZeroMath::compensated(calibration, _bandgapVoltage);
+  if (_isUserCalEnabled && !_isUserCalPiecewise) {
+    TemperatureZeroMath::applyUserCalibration(_conversion, _userCalGainCorrection, _userCalOffsetCorrection);
+    TemperatureZeroMath::applyUserCalibration(_compensated, _userCalGainCorrection, _userCalOffsetCorrection);
+  }
+  if (_lookupTable != NULL) {
+    buildLookupTable();
   }
+  updateFixedPointCoefficients(TemperatureZeroMath::fixedQuadratic(readFuses()));
+#endif
 }
 
 // Set user calibration params, using two point linear interpolation for hot and cold measurements
@@ -257,169 +1084,1321 @@ void TemperatureZero::setUserCalibration2P(float userCalColdGroundTruth,
                                             float userCalHotGroundTruth,
                                             float userCalHotMeasurement,
                                             bool isEnabled) {
-  _userCalOffsetCorrection = userCalColdMeasurement - userCalColdGroundTruth * (userCalHotMeasurement - userCalColdMeasurement) / (userCalHotGroundTruth - userCalColdGroundTruth);
-  _userCalGainCorrection = userCalHotGroundTruth / (userCalHotMeasurement - _userCalOffsetCorrection);
+  ensureCalibration();
+  TemperatureZeroMath::solveUserCalibration2P(userCalColdGroundTruth, userCalColdMeasurement,
+                                              userCalHotGroundTruth, userCalHotMeasurement,
+                                              _userCalGainCorrection, _userCalOffsetCorrection);
+  _userCalPointCount = 0;
   _isUserCalEnabled = isEnabled;
+  updateUserCalibration();
 }
 
 // Set user calibration params explixitly
 void TemperatureZero::setUserCalibration(float userCalGainCorrection,
                                           float userCalOffsetCorrection,
                                           bool isEnabled) {
+  ensureCalibration();
   _userCalOffsetCorrection = userCalOffsetCorrection;
   _userCalGainCorrection = userCalGainCorrection;
+  _userCalPointCount = 0;
   _isUserCalEnabled = isEnabled;
+  updateUserCalibration();
 }
 
-void TemperatureZero::enableUserCalibration() {
-  _isUserCalEnabled = true;
+// Convert the user calibration for the integer path and refresh the coefficients of both paths
+void TemperatureZero::updateUserCalibration() {
+#ifndef __SAMD51__
+  _userCalGainCorrectionQ16 = TemperatureZeroMath::toQ16(_userCalGainCorrection);
+  _userCalOffsetCorrectionMilliC = TemperatureZeroMath::toMilli(_userCalOffsetCorrection);
+#endif
+  updateCoefficients();
 }
 
-void TemperatureZero::disableUserCalibration() {
-  _isUserCalEnabled = false;
+// Supply the storage for the points of setUserCalibrationPoints(), capacity points of 24 bytes each
+// Without it, setUserCalibrationPoints() fails, and saved or retained records with points are not loaded.
+// It is kept by init() and initLazy(), so set it before those to load a calibration with points.
+// Points already set are moved over when they fit, the point calibration is dropped otherwise.
+void TemperatureZero::setUserCalibrationStorage(TemperatureZeroCalibrationPoint *points, uint8_t capacity) {
+  if (points == NULL) {
+    capacity = 0;
+  }
+  uint8_t count = _userCalPointCount <= capacity ? _userCalPointCount : 0;
+  for (uint8_t i = 0; i < count; i++) {
+    points[i] = _userCalPoints[i];
+  }
+  _userCalPoints = points;
+  _userCalPointCapacity = capacity;
+  if (count != _userCalPointCount) {
+    ensureCalibration();
+    _userCalPointCount = 0;
+    updateCoefficients();
+  }
 }
 
-// Get raw 12 bit adc reading
-uint16_t TemperatureZero::readInternalTemperatureRaw() {
+// Set a user calibration of up to the capacity of setUserCalibrationStorage() measurements against ground truths,
+// corrected by linear interpolation between the points, and beyond the outer points by the outer segments.
+// This replaces the gain and offset of setUserCalibration(), and applies to every conversion path.
+// Both the measurements (in increasing order) and the ground truths must increase from point to point,
+// so the correction stays monotonic. Returns false, changing nothing, when they do not, or when
+// the storage has no room for count points. saveUserCalibration() keeps up to TZ_CALIBRATION_MAX_POINTS.
+bool TemperatureZero::setUserCalibrationPoints(const float *groundTruths,
+                                                const float *measurements,
+                                                uint8_t count,
+                                                bool isEnabled) {
+  ensureCalibration();
+  if (groundTruths == NULL || measurements == NULL || count < 2 || count > _userCalPointCapacity) {
+    return false;
+  }
+  for (uint8_t i = 1; i < count; i++) {
+    if (measurements[i] <= measurements[i - 1] || groundTruths[i] <= groundTruths[i - 1]) {
+      return false;
+    }
+  }
+  _userCalPointCount = count;
+  TemperatureZeroMath::compileCalibrationPoints(_userCalPoints, measurements, groundTruths, count);
+  _isUserCalEnabled = isEnabled;
+  updateCoefficients();
+  return true;
+}
 
+// Piecewise correction of setUserCalibrationPoints(), see TemperatureZeroMath::applyCalibrationPoints()
+float TemperatureZero::applyUserCalibrationPoints(float temperature) {
+  return TemperatureZeroMath::applyCalibrationPoints(_userCalPoints, _userCalPointCount, temperature);
+}
 
-  // Save ADC settings
-  uint16_t oldReadResolution = ADC->CTRLB.reg;
-  uint16_t oldSampling = ADC->SAMPCTRL.reg;
-  uint16_t oldSampleAveraging = ADC->SAMPCTRL.reg;
-  uint16_t oldReferenceGain = ADC->INPUTCTRL.bit.GAIN;
-  uint16_t oldReferenceSelect = ADC->REFCTRL.bit.REFSEL;
+void TemperatureZero::enableUserCalibration() {
+  ensureCalibration();
+  _isUserCalEnabled = true;
+  updateCoefficients();
+}
+
+void TemperatureZero::disableUserCalibration() {
+  ensureCalibration();
+  _isUserCalEnabled = false;
+  updateCoefficients();
+}
+
+#ifndef __SAMD51__
+#define TZ_CALIBRATION_WORDS (sizeof(TemperatureZeroCalibrationRecord) / sizeof(uint32_t))
+
+// Save the user calibration and the coefficients derived from it, so init() starts with them
+// The record takes the last flash row, unless TZ_CALIBRATION_ADDRESS sets another, row aligned address.
+// Note: uploading a sketch erases the whole flash, including the record.
+// Returns false when the record could not be verified after writing, or, leaving the flash as it is,
+// when there are more than TZ_CALIBRATION_MAX_POINTS calibration points.
+bool TemperatureZero::saveUserCalibration() {
+  ensureCalibration();
+  TemperatureZeroCalibrationRecord record;
+  if (!fillCalibrationRecord(record, TZ_CALIBRATION_MAGIC)) {
+    return false;
+  }
+  record.crc = calibrationCrc(record);
+
+  writeCalibrationRow((const uint32_t *)&record, TZ_CALIBRATION_WORDS);
+  // The RAM copy of initLazy() no longer matches what init() would load
+  _retainedCalibration.magic = 0;
+  return memcmp(calibrationRow(), &record, sizeof(record)) == 0;
+}
+
+// Take over the calibration of saveUserCalibration(), as init() does
+// Returns false, leaving the calibration as it is, when no valid record for this chip is found.
+bool TemperatureZero::loadUserCalibration() {
+  ensureCalibration();
+  TemperatureZeroCalibrationRecord record;
+  memcpy(&record, calibrationRow(), sizeof(record));
+  if (!isCalibrationRecordValid(record, TZ_CALIBRATION_MAGIC) || record.crc != calibrationCrc(record)) {
+    return false;
+  }
+  applyCalibrationRecord(record);
+  return true;
+}
+
+// Remove the record of saveUserCalibration(), the next init() uses the factory calibration only
+void TemperatureZero::eraseUserCalibration() {
+  writeCalibrationRow(NULL, 0);
+  _retainedCalibration.magic = 0;
+}
 
+// Record of the current calibration, all but the crc
+// Returns false when the record has no room for all calibration points.
+bool TemperatureZero::fillCalibrationRecord(TemperatureZeroCalibrationRecord &record, uint32_t magic) {
+  memset(&record, 0, sizeof(record));
+  record.magic = magic;
+  record.version = TZ_CALIBRATION_VERSION;
+  record.size = sizeof(record);
+  record.fuses[0] = *(uint32_t*)FUSES_ROOM_TEMP_VAL_INT_ADDR;
+  record.fuses[1] = *(uint32_t*)FUSES_HOT_ADC_VAL_ADDR;
+  record.userCalGainCorrection = _userCalGainCorrection;
+  record.userCalOffsetCorrection = _userCalOffsetCorrection;
+  record.bandgapVoltage = _bandgapVoltage;
+  record.conversion = _conversion;
+  record.compensated = _compensated;
+  record.factoryMilliC = TemperatureZeroMath::fixedQuadratic(readFuses());
+  record.userCalGainCorrectionQ16 = _userCalGainCorrectionQ16;
+  record.userCalOffsetCorrectionMilliC = _userCalOffsetCorrectionMilliC;
+  record.isUserCalEnabled = _isUserCalEnabled;
+  record.userCalPointCount = _userCalPointCount;
+  if (_userCalPointCount > TZ_CALIBRATION_MAX_POINTS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < _userCalPointCount; i++) {
+    record.userCalMeasurements[i] = _userCalPoints[i].measurement;
+    record.userCalGroundTruths[i] = TemperatureZeroMath::calibrationGroundTruth(_userCalPoints, i);
+  }
+  return true;
+}
+
+// Check all fields of a record but the crc, including that it belongs to this chip, and that its
+// calibration points fit the storage of setUserCalibrationStorage()
+bool TemperatureZero::isCalibrationRecordValid(const TemperatureZeroCalibrationRecord &record, uint32_t magic) {
+  return record.magic == magic && record.version == TZ_CALIBRATION_VERSION && record.size == sizeof(record) &&
+         record.userCalPointCount != 1 && record.userCalPointCount <= TZ_CALIBRATION_MAX_POINTS &&
+         record.userCalPointCount <= _userCalPointCapacity &&
+         record.fuses[0] == *(uint32_t*)FUSES_ROOM_TEMP_VAL_INT_ADDR &&
+         record.fuses[1] == *(uint32_t*)FUSES_HOT_ADC_VAL_ADDR;
+}
+
+// Take over the calibration and the coefficients of a valid record
+void TemperatureZero::applyCalibrationRecord(const TemperatureZeroCalibrationRecord &record) {
+  _userCalGainCorrection = record.userCalGainCorrection;
+  _userCalOffsetCorrection = record.userCalOffsetCorrection;
+  _bandgapVoltage = record.bandgapVoltage;
+  _conversion = record.conversion;
+  _compensated = record.compensated;
+  _userCalGainCorrectionQ16 = record.userCalGainCorrectionQ16;
+  _userCalOffsetCorrectionMilliC = record.userCalOffsetCorrectionMilliC;
+  _isUserCalEnabled = record.isUserCalEnabled;
+  _userCalPointCount = record.userCalPointCount;
+  // Only the segments are derived again, a few divisions
+  TemperatureZeroMath::compileCalibrationPoints(_userCalPoints, record.userCalMeasurements, record.userCalGroundTruths,
+                                                _userCalPointCount);
+  updateFixedPointCoefficients(record.factoryMilliC);
+  if (_lookupTable != NULL) {
+    buildLookupTable();
+  }
+}
+
+// Start of the flash row holding the calibration record
+uint32_t *TemperatureZero::calibrationRow() {
+#ifdef TZ_CALIBRATION_ADDRESS
+  return (uint32_t *)(TZ_CALIBRATION_ADDRESS);
+#else
+  uint32_t pageSize = 8 << NVMCTRL->PARAM.bit.PSZ;
+  uint32_t flashSize = pageSize * NVMCTRL->PARAM.bit.NVMP;
+  return (uint32_t *)(flashSize - pageSize * NVMCTRL_ROW_PAGES);
+#endif
+}
+
+// CRC-32 (IEEE 802.3) of the record up to crc, bitwise, as it only runs on save and load
+uint32_t TemperatureZero::calibrationCrc(const TemperatureZeroCalibrationRecord &record) {
+  const uint8_t *data = (const uint8_t *)&record;
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < offsetof(TemperatureZeroCalibrationRecord, crc); i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+// Erase the calibration row and program count words into it, one page at a time
+void TemperatureZero::writeCalibrationRow(const uint32_t *words, uint16_t count) {
+  volatile uint32_t *row = calibrationRow();
+  uint16_t pageWords = (8 << NVMCTRL->PARAM.bit.PSZ) / sizeof(uint32_t);
+  uint32_t control = NVMCTRL->CTRLB.reg;
+  // Manual page writes, so a partly filled last page is written too
+  NVMCTRL->CTRLB.bit.MANW = 1;
+
+  noInterrupts();
+  // The address is given in 16 bit words
+  NVMCTRL->ADDR.reg = (uint32_t)row / 2;
+  NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+  while (!NVMCTRL->INTFLAG.bit.READY);
+  for (uint16_t first = 0; first < count; first += pageWords) {
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+    while (!NVMCTRL->INTFLAG.bit.READY);
+    // Writing to the flash addresses fills the page buffer
+    for (uint16_t i = first; i < count && i < first + pageWords; i++) {
+      row[i] = words[i];
+    }
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_WP;
+    while (!NVMCTRL->INTFLAG.bit.READY);
+  }
+  interrupts();
+
+  NVMCTRL->CTRLB.reg = control;
+}
+#endif
+
+#ifndef __SAMD51__
+// ADC settings for the temperature channel
+TemperatureZeroAdcSettings TemperatureZero::adcSettings(uint8_t averaging) {
+  TemperatureZeroAdcSettings settings;
   // Set to 12 bits resolution
-  ADC->CTRLB.reg = ADC_CTRLB_RESSEL_12BIT | ADC_CTRLB_PRESCALER_DIV256;
-  // Wait for synchronization of registers between the clock domains
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
+  settings.control = ADC_CTRLB_RESSEL_12BIT | ADC_CTRLB_PRESCALER_DIV256;
   // Ensure we are sampling slowly
-  ADC->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(0x3f);
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-   // Set ADC reference to internal 1v
-  ADC->INPUTCTRL.bit.GAIN = ADC_INPUTCTRL_GAIN_1X_Val;
-  ADC->REFCTRL.bit.REFSEL = ADC_REFCTRL_REFSEL_INT1V_Val;
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-   // Select MUXPOS as temperature channel, and MUXNEG  as internal ground
-  ADC->INPUTCTRL.bit.MUXPOS = ADC_INPUTCTRL_MUXPOS_TEMP_Val;
-  ADC->INPUTCTRL.bit.MUXNEG = ADC_INPUTCTRL_MUXNEG_GND_Val; 
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-   // Enable ADC
-  ADC->CTRLA.bit.ENABLE = 1;
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-  // Start ADC conversion & discard the first sample
+  settings.sampling = ADC_SAMPCTRL_SAMPLEN(0x3f);
+  settings.averaging = averaging;
+  // Select MUXPOS as temperature channel, and MUXNEG  as internal ground, at a gain of 1
+  settings.input = ADC_INPUTCTRL_GAIN_1X | ADC_INPUTCTRL_MUXPOS_TEMP | ADC_INPUTCTRL_MUXNEG_GND;
+  // Set ADC reference to internal 1v
+  settings.reference = ADC_REFCTRL_REFSEL_INT1V;
+  return settings;
+}
+
+// Take the ADC from the arbiter, setup the temperature channel and enable it
+// The averaging is left at a single sample, for the conversion that may have to be discarded.
+// Returns true when that first conversion must be discarded, which is not the case when the
+// ADC was still configured for the temperature channel.
+bool TemperatureZero::configureAdc() {
+  TemperatureZeroAdc::acquire();
+  return TemperatureZeroAdc::configure(adcSettings(0));
+}
+
+// Program the hardware averaging selected by setAveraging()
+void TemperatureZero::applyAveraging() {
+  TemperatureZeroAdc::configure(adcSettings(averagingControl()));
+}
+
+// Hand the ADC back to the arbiter, which restores all settings of the sketch
+void TemperatureZero::restoreAdcSettings() {
+  TemperatureZeroAdc::release();
+}
+
+// Start ADC conversion & discard the sample
+void TemperatureZero::discardConversion() {
+  TZ_STATS_ADD(discardedConversions, 1);
   ADC->SWTRIG.bit.START = 1;
   // Wait until ADC conversion is done, prevents the unexpected offset bug
   while (!(ADC->INTFLAG.bit.RESRDY));
    // Clear the Data Ready flag
   ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
-  // perform averaging
-  switch(_averaging) {
-    case TZ_AVERAGING_1: 
-      ADC->AVGCTRL.reg = 0;
-      break;
-    case TZ_AVERAGING_2: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_2 | ADC_AVGCTRL_ADJRES(0x1);
-      break;
-    case TZ_AVERAGING_4: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_4 | ADC_AVGCTRL_ADJRES(0x2);
-      break;
-    case TZ_AVERAGING_8: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_8 | ADC_AVGCTRL_ADJRES(0x3);
-      break;
-    case TZ_AVERAGING_16: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_16 | ADC_AVGCTRL_ADJRES(0x4);
-      break;
-    case TZ_AVERAGING_32: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_32 | ADC_AVGCTRL_ADJRES(0x4);
-      break;
-    case TZ_AVERAGING_64: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_64 | ADC_AVGCTRL_ADJRES(0x4);
-      break;
-    case TZ_AVERAGING_128: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_128 | ADC_AVGCTRL_ADJRES(0x4);
-      break;
-    case TZ_AVERAGING_256: 
-      ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_256 | ADC_AVGCTRL_ADJRES(0x4);
-      break;
-  }
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-   // Start conversion again, since The first conversion after the reference is changed must not be used.
+}
+
+// Run a single conversion on the already configured ADC
+uint16_t TemperatureZero::convert() {
+  TZ_STATS_ADD(conversions, 1);
   ADC->SWTRIG.bit.START = 1;
    // Wait until ADC conversion is done
   while (!(ADC->INTFLAG.bit.RESRDY));
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
+  syncAdc();
    // Get result
   uint16_t adcReading = ADC->RESULT.reg;
    // Clear result ready flag
   ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY; 
-    while (ADC->STATUS.bit.SYNCBUSY == 1);
-   // Disable ADC
-  ADC->CTRLA.bit.ENABLE = 0; 
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-   // Restore pervious ADC settings
-  ADC->CTRLB.reg = oldReadResolution;
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-  ADC->SAMPCTRL.reg = oldSampling;
-  ADC->SAMPCTRL.reg = oldSampleAveraging;
-  while (ADC->STATUS.bit.SYNCBUSY == 1);
-  ADC->INPUTCTRL.bit.GAIN = oldReferenceGain;
-  ADC->REFCTRL.bit.REFSEL = oldReferenceSelect;
-  while (ADC->STATUS.bit.SYNCBUSY == 1); 
+  syncAdc();
+  return adcReading;
+}
 
+// Get raw 12 bit adc reading
+// Within a session, the ADC is already setup for the temperature channel and only the conversion remains.
+uint16_t TemperatureZero::readInternalTemperatureRaw() {
+  lockAdc();
+  uint16_t adcReading = readTemperatureRaw();
+  unlockAdc();
   return adcReading;
+}
 
+// Convert and keep the result of the background conversion of readInternalTemperature(maxAgeMillis, true)
+// Waits for it when it is still in progress. The filter is applied as readInternalTemperature() does,
+// the adaptive averaging is left out, as the time the conversion took is unknown.
+float TemperatureZero::completeRefresh() {
+  _isRefreshing = false;
+  uint16_t adcReading = getResult();
+  float temperature = _lookupTable != NULL ? lookupTemperature(adcReading) : raw2temp(adcReading);
+  if (_filter != NULL) {
+    temperature = _filter->update(temperature);
+  }
+  storeReading(temperature);
+  return temperature;
+}
 
- #ifdef __SAMD51__ // M4
-  // enable and read 2 ADC temp sensors, 12-bit res
-  volatile uint16_t ptat;
-  volatile uint16_t ctat;
+// readInternalTemperatureRaw() within the lock of the caller
+uint16_t TemperatureZero::readTemperatureRaw() {
 
-  SUPC->VREF.reg |= SUPC_VREF_TSEN | SUPC_VREF_ONDEMAND; // activate temperature sensor
-  ADC0->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_12BIT_Val;
-  while (ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_CTRLB); //wait for sync
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_INPUTCTRL ); //wait for sync
-  ADC0->INPUTCTRL.bit.MUXPOS = ADC_INPUTCTRL_MUXPOS_PTAT;
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_ENABLE ); //wait for sync
-  ADC0->CTRLA.bit.ENABLE = 0x01;             // Enable ADC
+  if (_isRefreshing) {
+    // Take over the pending background conversion, rather than leave its older result to
+    // readInternalTemperature(maxAgeMillis) after this one
+    _isRefreshing = false;
+    return getResult();
+  }
 
-  // Start conversion
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_ENABLE ); //wait for sync
+  uint16_t adcReading;
+  while (!claimRead()) {
+    // The ADC is free running already, so return the most recent sample
+    if (readLatestSample(adcReading)) {
+      return adcReading;
+    }
+  }
 
-  ADC0->SWTRIG.bit.START = 1;
+  TZ_STATS_BEGIN_READ();
+  powerUp();
+  if (_isSessionActive) {
+    if (_sessionAveraging != _averaging) {
+      applyAveraging();
+      _sessionAveraging = _averaging;
+    }
+    adcReading = convert();
+    TZ_STATS_END_READ();
+    return adcReading;
+  }
 
-  // Clear the Data Ready flag
-  ADC0->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  if (configureAdc()) {
+    discardConversion();
+  }
+  // perform averaging
+  applyAveraging();
+   // Start conversion again, since The first conversion after the reference is changed must not be used.
+  adcReading = convert();
+  restoreAdcSettings();
+  unclaimRead();
+  powerDown();
+  TZ_STATS_END_READ();
 
-  // Start conversion again, since The first conversion after the reference is changed must not be used.
-  ADC0->SWTRIG.bit.START = 1;
+  return adcReading;
+}
 
-  while (ADC0->INTFLAG.bit.RESRDY == 0);   // Waiting for conversion to complete
-  ptat = ADC0->RESULT.reg;
 
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_INPUTCTRL ); //wait for sync
-  ADC0->INPUTCTRL.bit.MUXPOS = ADC_INPUTCTRL_MUXPOS_CTAT;
-  // Start conversion
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_ENABLE ); //wait for sync
+// Get raw 12 bit adc readings of the temperature sensor and of the bandgap reference, at half gain,
+// for raw2tempCompensated(). Both are taken in the same ADC setup, within a session too.
+// While a buffer holds the ADC, bandgapReading is 0, as the ADC only converts the temperature channel.
+void TemperatureZero::readCompensatedRaw(uint16_t &adcReading, uint16_t &bandgapReading) {
+  lockAdc();
+  if (!claimRead()) {
+    adcReading = readTemperatureRaw();
+    bandgapReading = 0;
+    unlockAdc();
+    return;
+  }
 
-  ADC0->SWTRIG.bit.START = 1;
+  TZ_STATS_BEGIN_READ();
+  powerUp();
+  // Route the bandgap to the ADC, for this read only, unless the sketch did so itself
+  bool wasBandgapRouted = SYSCTRL->VREF.reg & SYSCTRL_VREF_BGOUTEN;
+  SYSCTRL->VREF.reg |= SYSCTRL_VREF_BGOUTEN;
+  bool isSessionActive = _isSessionActive;
+  if (isSessionActive) {
+    if (_sessionAveraging != _averaging) {
+      applyAveraging();
+      _sessionAveraging = _averaging;
+    }
+  } else {
+    if (configureAdc()) {
+      discardConversion();
+    }
+    applyAveraging();
+  }
+  adcReading = convert();
+
+  TemperatureZeroAdcSettings settings = adcSettings(averagingControl());
+  settings.input = ADC_INPUTCTRL_GAIN_DIV2 | ADC_INPUTCTRL_MUXPOS_BANDGAP | ADC_INPUTCTRL_MUXNEG_GND;
+  switchAdc(settings);
+  bandgapReading = convert();
+  if (!wasBandgapRouted) {
+    SYSCTRL->VREF.reg &= ~SYSCTRL_VREF_BGOUTEN;
+  }
 
-  // Clear the Data Ready flag
-  ADC0->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  if (isSessionActive) {
+    // Leave the session as it was
+    switchAdc(adcSettings(averagingControl()));
+  } else {
+    restoreAdcSettings();
+    unclaimRead();
+    powerDown();
+  }
+  TZ_STATS_END_READ();
+  unlockAdc();
+}
 
-  // Start conversion again, since The first conversion after the reference is changed must not be used.
-  ADC0->SWTRIG.bit.START = 1;
+// Change the acquired ADC to settings, discarding the first conversion, at a single sample, when
+// the gain or reference changes
+void TemperatureZero::switchAdc(TemperatureZeroAdcSettings settings) {
+  uint8_t averaging = settings.averaging;
+  settings.averaging = 0;
+  if (TemperatureZeroAdc::configure(settings)) {
+    discardConversion();
+  }
+  settings.averaging = averaging;
+  TemperatureZeroAdc::configure(settings);
+}
 
-  while (ADC0->INTFLAG.bit.RESRDY == 0);   // Waiting for conversion to complete
-  ctat = ADC0->RESULT.reg;
+// Claim the ADC for blocking work within the lock of setLockHooks(), by reads of any instance, scan(),
+// sessions, TemperatureZeroT and TemperatureZeroAdc::runQueue(). The non-blocking conversions and the
+// buffers complete in interrupts, without the lock, so they are honoured here instead: a pending
+// conversion is completed first, as a blocking read would change its setup and start a second one.
+// Returns false while a buffer holds the ADC, as the DMAC takes every result, see readLatestSample().
+// Until unclaimAdc(), startConversion() and the buffers refuse to start.
+bool TemperatureZero::claimAdc() {
+  while (true) {
+    noInterrupts();
+    TemperatureZero *conversion = _activeConversion;
+    TemperatureZero *continuous = _activeContinuous;
+    if (conversion == NULL && continuous == NULL) {
+      _blockingClaims++;
+      interrupts();
+      return true;
+    }
+    interrupts();
+    if (conversion == NULL) {
+      return false;
+    }
+    // Polled as well, in case the ADC interrupt is not forwarded
+    conversion->isConversionReady();
+  }
+}
 
+void TemperatureZero::unclaimAdc() {
+  noInterrupts();
+  _blockingClaims--;
+  interrupts();
+}
 
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_ENABLE ); //wait for sync
-  ADC0->CTRLA.bit.ENABLE = 0x00;             // Disable ADC
-  while ( ADC0->SYNCBUSY.reg & ADC_SYNCBUSY_ENABLE ); //wait for sync 
+// Most recent sample of the running buffer, for blocking reads while it holds the ADC
+// Waits for the first sample. Returns false when no buffer is running (anymore).
+bool TemperatureZero::readLatestSample(uint16_t &adcReading) {
+  TemperatureZero *continuous = _activeContinuous;
+  if (continuous == NULL) {
+    return false;
+  }
+  uint32_t written;
+  while ((written = continuous->getBufferWritten()) == 0) {
+    if (_activeContinuous != continuous) {
+      return false;
+    }
+  }
+  adcReading = continuous->_buffer[(written - 1) % continuous->_bufferLength];
+  return true;
+}
 
-  return raw2temp(ptat, ctat);
-  
-  #endif
+// claimAdc() for a read of this instance
+// A session holds the claim already, so only its own pending non-blocking conversion is completed.
+bool TemperatureZero::claimRead() {
+  if (_isSessionActive) {
+    getResult();
+    return true;
+  }
+  return claimAdc();
 }
+
+void TemperatureZero::unclaimRead() {
+  if (!_isSessionActive) {
+    unclaimAdc();
+  }
+}
+
+// Get a raw adc reading with 12 + extraBits bits (up to TZ_OVERSAMPLING_MAX_BITS), convert it with
+// raw2temp(reading, extraBits). The hardware averaging of the ADC is limited to a 12 bit result, so
+// 4^extraBits hardware averaged readings are accumulated here and decimated by 2^extraBits.
+// During continuous sampling, the most recent samples of the buffer are used without any conversion,
+// provided the buffer holds at least 4^extraBits samples. Otherwise all readings are converted here,
+// so use a short averaging like TZ_AVERAGING_1 or TZ_AVERAGING_4 to keep the call short.
+// While the buffer of another instance holds the ADC, its most recent sample is returned, scaled up.
+uint32_t TemperatureZero::readInternalTemperatureOversampled(uint8_t extraBits) {
+  if (extraBits > TZ_OVERSAMPLING_MAX_BITS) {
+    extraBits = TZ_OVERSAMPLING_MAX_BITS;
+  }
+  uint16_t count = 1 << (2 * extraBits);
+  uint32_t sum = 0;
+
+  if (_activeContinuous == this) {
+    uint32_t written;
+    if (_bufferLength >= count) {
+      while ((written = getBufferWritten()) < count);
+      uint16_t index = written % _bufferLength;
+      for (uint16_t i = 0; i < count; i++) {
+        index = index == 0 ? _bufferLength - 1 : index - 1;
+        sum += _buffer[index];
+      }
+    } else {
+      // The buffer is too short, so accumulate the samples as they come in
+      for (uint16_t i = 0; i < count; i++) {
+        written = getBufferWritten();
+        while (getBufferWritten() == written);
+        sum += _buffer[written % _bufferLength];
+      }
+    }
+    return TemperatureZeroMath::decimate(sum, extraBits);
+  }
+
+  lockAdc();
+  if (!claimRead()) {
+    sum = (uint32_t)readTemperatureRaw() << extraBits;
+    unlockAdc();
+    return sum;
+  }
+  TZ_STATS_BEGIN_READ();
+  powerUp();
+  bool isSessionActive = _isSessionActive;
+  if (isSessionActive) {
+    if (_sessionAveraging != _averaging) {
+      applyAveraging();
+      _sessionAveraging = _averaging;
+    }
+  } else {
+    if (configureAdc()) {
+      discardConversion();
+    }
+    applyAveraging();
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    sum += convert();
+  }
+  if (!isSessionActive) {
+    restoreAdcSettings();
+    unclaimRead();
+    powerDown();
+  }
+  TZ_STATS_END_READ();
+  unlockAdc();
+  return TemperatureZeroMath::decimate(sum, extraBits);
+}
+
+
+// Convert the temperature, both supply voltages and up to TZ_SCAN_MAX_PINS analog pins into frame
+// The ADC is taken and set up once per frame. Both supply channels are converted in one INPUTSCAN
+// sequence right after the temperature, as are pins on consecutive ADC inputs, e.g. A1 and A2 on a Zero.
+// A pending non-blocking conversion is completed first. Returns false when the ADC is busy with a
+// session or a buffer.
+bool TemperatureZero::scan(TemperatureZeroFrame &frame, const uint8_t *pins, uint8_t pinCount) {
+  if (pinCount > TZ_SCAN_MAX_PINS || (pinCount > 0 && pins == NULL) || _isSessionActive) {
+    return false;
+  }
+  TemperatureZeroAdc::lock();
+  if (!claimAdc()) {
+    TemperatureZeroAdc::unlock();
+    return false;
+  }
+  TZ_STATS_BEGIN_READ();
+  powerUp();
+
+  if (configureAdc()) {
+    discardConversion();
+  }
+  TemperatureZeroAdcSettings settings = adcSettings(averagingControl());
+  scanChannels(settings, ADC_INPUTCTRL_MUXPOS_TEMP_Val, 1, &frame.temperatureRaw);
+  uint16_t supplyReadings[2];
+  scanChannels(settings, ADC_INPUTCTRL_MUXPOS_SCALEDCOREVCC_Val, 2, supplyReadings);
+  frame.coreVoltageRaw = supplyReadings[0];
+  frame.ioVoltageRaw = supplyReadings[1];
+
+  // Pins in a row of ADC inputs share one sequence
+  uint8_t first = 0;
+  while (first < pinCount) {
+    settings = TemperatureZeroAdc::pinSettings(pins[first]);
+    uint8_t channel = g_APinDescription[pins[first]].ulADCChannelNumber;
+    uint8_t count = 1;
+    while (first + count < pinCount && g_APinDescription[pins[first + count]].ulADCChannelNumber == channel + count) {
+      TemperatureZeroAdc::pinSettings(pins[first + count]);
+      count++;
+    }
+    scanChannels(settings, channel, count, &frame.pinReadings[first]);
+    first += count;
+  }
+  frame.pinCount = pinCount;
+
+  restoreAdcSettings();
+  TZ_STATS_END_READ();
+  unclaimAdc();
+  powerDown();
+  TemperatureZeroAdc::unlock();
+
+  frame.temperature = raw2temp(frame.temperatureRaw);
+  frame.coreVoltage = frame.coreVoltageRaw * 4.0f / ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+  frame.ioVoltage = frame.ioVoltageRaw * 4.0f / ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+  return true;
+}
+
+// Convert count consecutive ADC inputs from firstChannel on, with a single INPUTCTRL setup
+// The ADC steps INPUTOFFSET itself after every conversion, and wraps it back to 0 after the last.
+void TemperatureZero::scanChannels(TemperatureZeroAdcSettings settings, uint8_t firstChannel, uint8_t count, uint16_t *readings) {
+  settings.input = (settings.input & ~(ADC_INPUTCTRL_MUXPOS_Msk | ADC_INPUTCTRL_INPUTSCAN_Msk | ADC_INPUTCTRL_INPUTOFFSET_Msk)) |
+                   ADC_INPUTCTRL_MUXPOS(firstChannel) | ADC_INPUTCTRL_INPUTSCAN(count - 1);
+  if (TemperatureZeroAdc::configure(settings)) {
+    // The first conversion after the reference is changed must not be used, start the scan over
+    TZ_STATS_ADD(discardedConversions, 1);
+    TemperatureZeroAdc::convert();
+    ADC->INPUTCTRL.reg = settings.input;
+    syncAdc();
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    TZ_STATS_ADD(conversions, 1);
+    readings[i] = TemperatureZeroAdc::convert();
+  }
+}
+
+
+// Setup the ADC for the temperature channel once, for a series of reads
+// Until endSession(), reads skip saving/restoring the ADC settings and the discarded first sample.
+// Do not use analogRead() while a session is active, as it shares the ADC.
+// The session claims the ADC like a blocking read, see claimAdc(). Returns false, without a session,
+// when a buffer holds the ADC.
+bool TemperatureZero::beginSession() {
+  if (_isSessionActive) {
+    return true;
+  }
+  TemperatureZeroAdc::lock();
+  if (!claimAdc()) {
+    TemperatureZeroAdc::unlock();
+    return false;
+  }
+  powerUp();
+  if (configureAdc()) {
+    discardConversion();
+  }
+  applyAveraging();
+  _sessionAveraging = _averaging;
+  _isSessionActive = true;
+  return true;
+}
+
+// Close the session, disabling the ADC and restoring its previous settings
+void TemperatureZero::endSession() {
+  if (!_isSessionActive) {
+    return;
+  }
+  // A pending non-blocking conversion needs the ADC until it has completed
+  getResult();
+  restoreAdcSettings();
+  _isSessionActive = false;
+  unclaimAdc();
+  powerDown();
+  TemperatureZeroAdc::unlock();
+}
+
+bool TemperatureZero::isSessionActive() {
+  return _isSessionActive;
+}
+
+// Start a non-blocking conversion, using the same ADC setup as readInternalTemperatureRaw()
+// The ADC RESRDY interrupt advances the conversion, so the CPU is free during the averaging.
+// Returns false when a non-blocking conversion (of any instance) is still in progress, or when a
+// buffer or a blocking read holds the ADC. Within a session, which holds it already, only the former.
+bool TemperatureZero::startConversion() {
+  noInterrupts();
+  if (_activeConversion != NULL || (!_isSessionActive && (_activeContinuous != NULL || _blockingClaims != 0))) {
+    interrupts();
+    return false;
+  }
+  _activeConversion = this;
+  interrupts();
+  // Left enabled until the next read or servicePower(), as the conversion completes in the interrupt
+  powerUp();
+
+  if (_isSessionActive) {
+    if (_sessionAveraging != _averaging) {
+      applyAveraging();
+      _sessionAveraging = _averaging;
+    }
+    _conversionState = TZ_CONVERSION_BUSY;
+  } else if (configureAdc()) {
+    _conversionState = TZ_CONVERSION_DISCARD;
+  } else {
+    // The ADC was still configured for the temperature channel, so no sample needs to be discarded
+    applyAveraging();
+    _conversionState = TZ_CONVERSION_BUSY;
+  }
+  // Let the result ready interrupt drive the rest of the conversion
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  ADC->INTENSET.reg = ADC_INTENSET_RESRDY;
+  NVIC_EnableIRQ(ADC_IRQn);
+  // Start ADC conversion, outside a session the first sample is discarded in serviceConversion()
+  ADC->SWTRIG.bit.START = 1;
+  return true;
+}
+
+// Check whether the conversion started by startConversion() has completed
+// Also works when the ADC interrupt is not forwarded, as the result ready flag is polled here too.
+bool TemperatureZero::isConversionReady() {
+  if (_conversionState == TZ_CONVERSION_DISCARD || _conversionState == TZ_CONVERSION_BUSY) {
+    noInterrupts();
+    serviceConversion();
+    interrupts();
+  }
+  return _conversionState == TZ_CONVERSION_READY;
+}
+
+// Get the raw 12 bit adc reading of the last non-blocking conversion
+// Waits for completion when the conversion is still in progress.
+uint16_t TemperatureZero::getResult() {
+  while (_conversionState == TZ_CONVERSION_DISCARD || _conversionState == TZ_CONVERSION_BUSY) {
+    isConversionReady();
+  }
+  return _conversionResult;
+}
+
+// Set a function to be called from the ADC interrupt as soon as a non-blocking conversion completes
+// Pass NULL to remove it again.
+void TemperatureZero::setConversionCallback(TemperatureZeroCallback callback) {
+  _conversionCallback = callback;
+}
+
+// ADC interrupt entry point. Only needs to be called manually when the sketch, or another library,
+// defines its own ADC_Handler(), which then replaces the weak one of this library and should forward
+// to this function.
+void TemperatureZero::handleInterrupt() {
+  TemperatureZero *conversion = _activeConversion;
+  if (conversion != NULL) {
+    conversion->serviceConversion();
+  }
+  TemperatureZero *continuous = _activeContinuous;
+  if (continuous != NULL && _isAlarmArmed && _alarmOwner == continuous) {
+    continuous->serviceAlarm();
+  }
+}
+
+// Advance the non-blocking conversion state machine when a result is available
+void TemperatureZero::serviceConversion() {
+  if (!(ADC->INTFLAG.bit.RESRDY)) {
+    return;
+  }
+  if (_conversionState == TZ_CONVERSION_DISCARD) {
+    TZ_STATS_ADD(discardedConversions, 1);
+     // Clear the Data Ready flag
+    ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+    // perform averaging
+    applyAveraging();
+     // Start conversion again, since The first conversion after the reference is changed must not be used.
+    _conversionState = TZ_CONVERSION_BUSY;
+    ADC->SWTRIG.bit.START = 1;
+  } else if (_conversionState == TZ_CONVERSION_BUSY) {
+    TZ_STATS_ADD(conversions, 1);
+    syncAdc();
+     // Get result
+    _conversionResult = ADC->RESULT.reg;
+     // Clear result ready flag
+    ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+    ADC->INTENCLR.reg = ADC_INTENCLR_RESRDY;
+    syncAdc();
+    if (!_isSessionActive) {
+      restoreAdcSettings();
+    }
+    _conversionState = TZ_CONVERSION_READY;
+    _activeConversion = NULL;
+    if (_conversionCallback != NULL) {
+      _conversionCallback(_conversionResult);
+    }
+  }
+}
+
+
+// Start free running conversions of the temperature channel, stored by the DMAC in a ring buffer
+// The caller supplied buffer of length samples is filled continuously, without any CPU involvement.
+// Fetch samples with readBuffer(), or convert them in place from getBufferTail() and consumeBuffer().
+// Samples that are overwritten before they were consumed are counted by getOverrunCount().
+// Returns false when the ADC is busy with a session, a blocking read, a non-blocking conversion or
+// another buffer, or when another library already uses DMA channel TZ_DMA_CHANNEL.
+bool TemperatureZero::startContinuous(uint16_t *buffer, uint16_t length) {
+  if (!startBuffer(buffer, length, NULL)) {
+    return false;
+  }
+  // Let the ADC convert continuously
+  ADC->CTRLB.bit.FREERUN = 1;
+  syncAdc();
+  ADC->SWTRIG.bit.START = 1;
+  return true;
+}
+
+// Start conversions of the temperature channel on each event of eventGenerator, e.g.
+// TZ_RTC_PERIODIC_EVENT(7) for 1 Hz with the 1.024 kHz RTC clock RTCZero sets up.
+// The conversions are triggered through the event system and stored by the DMAC in the same ring
+// buffer as startContinuous(), so the CPU can sleep in between. It only gets woken to call the
+// optional callback once every length samples, when the buffer is full.
+// For RTC periodic events the RTC must be running already, its event output is enabled here.
+// Sampling continues in standby sleep only when the clock of the ADC runs in standby as well.
+// Stop with stopContinuous(), which disables the RTC event output again. Returns false when the ADC
+// is busy, just like startContinuous(), or when eventGenerator is 0.
+bool TemperatureZero::startScheduledSampling(uint16_t *buffer, uint16_t length, uint8_t eventGenerator,
+                                             TemperatureZeroBufferCallback callback) {
+  // startBuffer() powers up the sensor only once it claimed the ADC
+  if (eventGenerator == 0 || !startBuffer(buffer, length, callback)) {
+    return false;
+  }
+  if (eventGenerator >= EVSYS_ID_GEN_RTC_PER_0 && eventGenerator <= EVSYS_ID_GEN_RTC_PER_7) {
+    RTC->MODE2.EVCTRL.reg |= RTC_MODE2_EVCTRL_PEREO(1 << (eventGenerator - EVSYS_ID_GEN_RTC_PER_0));
+  }
+  // Route the event to the ADC start input, asynchronous so no clock is needed for the channel
+  PM->APBCMASK.reg |= PM_APBCMASK_EVSYS;
+  EVSYS->USER.reg = EVSYS_USER_USER(EVSYS_ID_USER_ADC_START) | EVSYS_USER_CHANNEL(TZ_EVSYS_CHANNEL + 1);
+  EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(TZ_EVSYS_CHANNEL) | EVSYS_CHANNEL_EVGEN(eventGenerator) |
+                       EVSYS_CHANNEL_PATH_ASYNCHRONOUS | EVSYS_CHANNEL_EDGSEL_NO_EVT_OUTPUT;
+  ADC->EVCTRL.reg = ADC_EVCTRL_STARTEI;
+  ADC->CTRLA.bit.RUNSTDBY = 1;
+  syncAdc();
+  _scheduledGenerator = eventGenerator;
+  return true;
+}
+
+// Claim the ADC and setup the DMAC to copy every conversion result into the ring buffer
+bool TemperatureZero::startBuffer(uint16_t *buffer, uint16_t length, TemperatureZeroBufferCallback callback) {
+  if (buffer == NULL || length == 0 || _isSessionActive) {
+    return false;
+  }
+  noInterrupts();
+  if (_activeConversion != NULL || _activeContinuous != NULL || _blockingClaims != 0 || isDmaChannelTaken()) {
+    interrupts();
+    return false;
+  }
+  _activeContinuous = this;
+  _bufferOwner = this;
+  interrupts();
+
+  _buffer = buffer;
+  _bufferLength = length;
+  _bufferWraps = 0;
+  _bufferWritten = 0;
+  _bufferConsumed = 0;
+  _overrunCount = 0;
+  _bufferCallback = callback;
+  _scheduledGenerator = 0;
+
+  powerUp();
+  if (configureAdc()) {
+    discardConversion();
+  }
+  applyAveraging();
+  // Kept for readSamples(), as _averaging may change while the buffer is filled
+  _sessionAveraging = _averaging;
+  applyAlarmWindow();
+
+  // Setup the DMAC, unless another library already did so
+  if (!DMAC->CTRL.bit.DMAENABLE) {
+    PM->AHBMASK.bit.DMAC_ = 1;
+    PM->APBBMASK.bit.DMAC_ = 1;
+    DMAC->BASEADDR.reg = (uint32_t)_dmaDescriptors;
+    DMAC->WRBADDR.reg = (uint32_t)_dmaWriteback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+  }
+  // Copy every result into the buffer, the descriptor links to itself to wrap around
+  DmacDescriptor *descriptor = dmaDescriptor();
+  descriptor->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BLOCKACT_INT | DMAC_BTCTRL_BEATSIZE_HWORD | DMAC_BTCTRL_DSTINC;
+  descriptor->BTCNT.reg = length;
+  descriptor->SRCADDR.reg = (uint32_t)&ADC->RESULT.reg;
+  descriptor->DSTADDR.reg = (uint32_t)(buffer + length); // end address, as the destination increments
+  descriptor->DESCADDR.reg = (uint32_t)descriptor;
+
+  noInterrupts();
+  uint8_t channel = DMAC->CHID.reg;
+  DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while (DMAC->CHCTRLA.bit.SWRST);
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(ADC_DMAC_ID_RESRDY) | DMAC_CHCTRLB_TRIGACT_BEAT;
+  // The block complete interrupt keeps track of the wrap arounds
+  DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+  DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+  DMAC->CHID.reg = channel;
+  _bufferAnchorMicros = micros();
+  _bufferAnchorWritten = 0;
+  interrupts();
+  NVIC_EnableIRQ(DMAC_IRQn);
+  return true;
+}
+
+// Stop free running or scheduled conversions and restore the ADC settings
+// Samples still in the buffer remain available, until any instance starts a buffer again.
+void TemperatureZero::stopContinuous() {
+  if (_activeContinuous != this) {
+    return;
+  }
+  if (_scheduledGenerator != 0) {
+    // Disconnect the event channel from the ADC start input, and free the channel and the RTC output again
+    EVSYS->USER.reg = EVSYS_USER_USER(EVSYS_ID_USER_ADC_START) | EVSYS_USER_CHANNEL(0);
+    EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(TZ_EVSYS_CHANNEL) | EVSYS_CHANNEL_EVGEN(0);
+    if (_scheduledGenerator >= EVSYS_ID_GEN_RTC_PER_0 && _scheduledGenerator <= EVSYS_ID_GEN_RTC_PER_7) {
+      RTC->MODE2.EVCTRL.reg &= ~RTC_MODE2_EVCTRL_PEREO(1 << (_scheduledGenerator - EVSYS_ID_GEN_RTC_PER_0));
+    }
+    ADC->EVCTRL.reg = 0;
+    ADC->CTRLA.bit.RUNSTDBY = 0;
+    syncAdc();
+    _scheduledGenerator = 0;
+  }
+  noInterrupts();
+  uint8_t channel = DMAC->CHID.reg;
+  // Leave the channel alone when another library took it over meanwhile
+  bool isOurs = isDmaChannelOurs(_buffer + _bufferLength);
+  if (isOurs) {
+    DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    while (DMAC->CHCTRLA.bit.ENABLE);
+    DMAC->CHID.reg = channel;
+  }
+  interrupts();
+  _bufferStopMicros = micros();
+  // Without the channel, only the completed blocks are known
+  _bufferWritten = isOurs ? getBufferWritten() : _bufferWraps * _bufferLength;
+  noInterrupts();
+  if (isOurs) {
+    DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+    DMAC->CHINTENCLR.reg = DMAC_CHINTENCLR_TCMPL;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+    DMAC->CHID.reg = channel;
+    // Free the descriptor, so isDmaChannelTaken() does not count it for the next start
+    dmaDescriptor()->BTCTRL.reg = 0;
+  }
+  _activeContinuous = NULL;
+  interrupts();
+
+  // Leave the window monitor and free running mode disabled for other users of the ADC
+  ADC->INTENCLR.reg = ADC_INTENCLR_WINMON;
+  ADC->WINCTRL.reg = ADC_WINCTRL_WINMODE_DISABLE;
+  syncAdc();
+  ADC->CTRLB.bit.FREERUN = 0;
+  syncAdc();
+  restoreAdcSettings();
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY | ADC_INTFLAG_WINMON;
+  powerDown();
+}
+
+// Also false when another library reset the DMAC and so stopped the buffer, stopContinuous() then
+// still hands the ADC back.
+bool TemperatureZero::isContinuousActive() {
+  if (_activeContinuous != this) {
+    return false;
+  }
+  noInterrupts();
+  uint8_t channel = DMAC->CHID.reg;
+  DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+  bool isRunning = DMAC->CHCTRLA.bit.ENABLE && isDmaChannelOurs(_buffer + _bufferLength);
+  DMAC->CHID.reg = channel;
+  interrupts();
+  return isRunning;
+}
+
+// Total number of samples written into the buffer since startContinuous()
+uint32_t TemperatureZero::getBufferWritten() {
+  if (_activeContinuous != this) {
+    return _bufferOwner == this ? _bufferWritten : 0;
+  }
+  noInterrupts();
+  uint32_t wraps = _bufferWraps;
+  uint16_t remaining;
+  if (DMAC->ACTIVE.bit.ABUSY && DMAC->ACTIVE.bit.ID == TZ_DMA_CHANNEL) {
+    remaining = DMAC->ACTIVE.bit.BTCNT;
+  } else {
+    remaining = ((DmacDescriptor *)DMAC->WRBADDR.reg + TZ_DMA_CHANNEL)->BTCNT.reg;
+  }
+  // A completed block of which the interrupt is still pending is not counted in wraps yet
+  uint8_t channel = DMAC->CHID.reg;
+  DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+  if (DMAC->CHINTFLAG.bit.TCMPL) {
+    wraps++;
+  }
+  DMAC->CHID.reg = channel;
+  interrupts();
+  // A remaining count of zero means the block completed, but the descriptor is not reloaded yet
+  uint16_t filled = remaining == 0 ? 0 : _bufferLength - remaining;
+  return wraps * _bufferLength + filled;
+}
+
+// Index of the buffer entry the DMAC will write next
+uint16_t TemperatureZero::getBufferHead() {
+  if (_bufferOwner != this || _bufferLength == 0) {
+    return 0;
+  }
+  return getBufferWritten() % _bufferLength;
+}
+
+// Index of the oldest sample that is not consumed yet
+uint16_t TemperatureZero::getBufferTail() {
+  getBufferAvailable(); // skips the tail past any overwritten samples
+  if (_bufferOwner != this || _bufferLength == 0) {
+    return 0;
+  }
+  return _bufferConsumed % _bufferLength;
+}
+
+// Number of samples ready to be consumed, none when the buffer belongs to another instance
+uint16_t TemperatureZero::getBufferAvailable() {
+  if (_bufferOwner != this) {
+    return 0;
+  }
+  uint32_t available = getBufferWritten() - _bufferConsumed;
+  if (available > _bufferLength) {
+    // The DMAC went around and overwrote samples that were not consumed
+    _overrunCount += available - _bufferLength;
+    _bufferConsumed += available - _bufferLength;
+    available = _bufferLength;
+  }
+  return available;
+}
+
+// Copy up to count samples, oldest first, into destination and consume them
+// Returns the number of samples copied.
+uint16_t TemperatureZero::readBuffer(uint16_t *destination, uint16_t count) {
+  uint16_t available = getBufferAvailable();
+  if (count > available) {
+    count = available;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  uint16_t tail = _bufferConsumed % _bufferLength;
+  for (uint16_t i = 0; i < count; i++) {
+    destination[i] = _buffer[tail];
+    if (++tail == _bufferLength) {
+      tail = 0;
+    }
+  }
+  _bufferConsumed += count;
+  return count;
+}
+
+// Mark count samples from the tail as consumed, e.g. after converting them in place
+void TemperatureZero::consumeBuffer(uint16_t count) {
+  uint16_t available = getBufferAvailable();
+  _bufferConsumed += count > available ? available : count;
+}
+
+// Blocking read of a sample, timestamped at the end of the conversion
+// During continuous sampling this is the most recent sample of the buffer, like readInternalTemperatureRaw().
+void TemperatureZero::readSample(TemperatureZeroSample &sample) {
+  bool isBuffered = _activeContinuous == this;
+  sample.raw = readInternalTemperatureRaw();
+  sample.timestamp = micros();
+  sample.averaging = isBuffered ? _sessionAveraging : _averaging;
+  sample.flags = (_isUserCalEnabled ? TZ_SAMPLE_USER_CALIBRATED : 0) | (isBuffered ? TZ_SAMPLE_BUFFERED : 0);
+}
+
+// Like readBuffer(), but with the samples timestamped for telemetry, see TemperatureZeroEncoder
+// The DMAC does not record when it stores a sample, so the timestamps are spaced evenly from the last
+// sample returned by the previous call to the newest one in the buffer, which is taken as written now.
+// They are accurate to about one sample period when the samples are fetched regularly. The first sample
+// after samples were lost to an overrun is flagged with TZ_SAMPLE_OVERRUN.
+uint16_t TemperatureZero::readSamples(TemperatureZeroSample *destination, uint16_t count) {
+  uint32_t overrunCount = _overrunCount;
+  uint16_t available = getBufferAvailable();
+  if (count > available) {
+    count = available;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  uint32_t written = getBufferWritten();
+  uint32_t now = _activeContinuous == this ? micros() : _bufferStopMicros;
+  // Time per sample in 1/256 us, derived once, so each sample only takes an addition
+  uint64_t step = ((uint64_t)(now - _bufferAnchorMicros) << 8) / (written - _bufferAnchorWritten);
+  uint64_t time = ((uint64_t)_bufferAnchorMicros << 8) + step * (_bufferConsumed + 1 - _bufferAnchorWritten);
+  uint8_t flags = TZ_SAMPLE_BUFFERED | (_isUserCalEnabled ? TZ_SAMPLE_USER_CALIBRATED : 0);
+  if (_overrunCount != overrunCount) {
+    flags |= TZ_SAMPLE_OVERRUN;
+  }
+  uint16_t tail = _bufferConsumed % _bufferLength;
+  for (uint16_t i = 0; i < count; i++) {
+    TemperatureZeroSample &sample = destination[i];
+    sample.timestamp = (uint32_t)(time >> 8);
+    sample.raw = _buffer[tail];
+    sample.averaging = _sessionAveraging;
+    sample.flags = flags;
+    flags &= ~TZ_SAMPLE_OVERRUN;
+    time += step;
+    if (++tail == _bufferLength) {
+      tail = 0;
+    }
+  }
+  _bufferConsumed += count;
+  _bufferAnchorMicros = destination[count - 1].timestamp;
+  _bufferAnchorWritten = _bufferConsumed;
+  return count;
+}
+
+// Number of samples overwritten by the DMAC before they were consumed
+uint32_t TemperatureZero::getOverrunCount() {
+  getBufferAvailable();
+  return _bufferOwner == this ? _overrunCount : 0;
+}
+
+// DMAC interrupt entry point. Only needs to be called manually when the sketch, or another library,
+// defines its own DMAC_Handler(), which replaces the weak one of this library and should forward to
+// this function, like the ADC_Handler() of handleInterrupt().
+void TemperatureZero::handleDmaInterrupt() {
+  uint8_t channel = DMAC->CHID.reg;
+  DMAC->CHID.reg = DMAC_CHID_ID(TZ_DMA_CHANNEL);
+  if (DMAC->CHINTFLAG.bit.TCMPL) {
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+    TemperatureZero *continuous = _activeContinuous;
+    if (continuous != NULL) {
+      continuous->_bufferWraps++;
+      if (continuous->_bufferCallback != NULL) {
+        continuous->_bufferCallback(continuous->_buffer, continuous->_bufferLength);
+      }
+    }
+  }
+  DMAC->CHID.reg = channel;
+}
+
+// Raise an alarm when the temperature leaves the band from lowC to highC
+// The limits are converted to raw readings once, so the window monitor of the ADC compares every
+// sample in hardware and the CPU only wakes up for the ADC interrupt when the band is left.
+// The alarm is active during startContinuous() and startScheduledSampling(), and fires only once:
+// the callback gets the reading that was out of the band, call setAlarmWindow() again to rearm.
+// The limits follow the calibration at the time of the call, a limit beyond the range of the readings
+// leaves that side of the band open. There is one alarm, shared like the buffer, the last instance to
+// set it owns it. Returns false when lowC > highC, or while the buffer of another instance runs.
+bool TemperatureZero::setAlarmWindow(float lowC, float highC, TemperatureZeroCallback callback) {
+  ensureCalibration();
+  if (lowC > highC || (_activeContinuous != NULL && _activeContinuous != this)) {
+    return false;
+  }
+  _alarmOwner = this;
+  // Readings below _alarmLow and from _alarmHigh on are out of the band
+  _alarmLow = temp2raw(lowC);
+  _alarmHigh = temp2raw(highC);
+  _alarmCallback = callback;
+  _isAlarmArmed = true;
+  if (_activeContinuous == this) {
+    applyAlarmWindow();
+  }
+  return true;
+}
+
+// Disarm the alarm set by setAlarmWindow()
+void TemperatureZero::clearAlarmWindow() {
+  if (_alarmOwner != this) {
+    return;
+  }
+  _isAlarmArmed = false;
+  if (_activeContinuous == this) {
+    applyAlarmWindow();
+  }
+}
+
+// Check whether the alarm is still waiting for the temperature to leave the band
+bool TemperatureZero::isAlarmArmed() {
+  return _alarmOwner == this && _isAlarmArmed;
+}
+
+// Find the lowest raw reading that converts to more than celsius, 4096 when there is none
+// It converts like raw2temp(), without adding trace records for the readings it tries.
+uint16_t TemperatureZero::temp2raw(float celsius) {
+  return TemperatureZeroMath::temp2raw(_conversion, _userCalPoints, _isUserCalPiecewise ? _userCalPointCount : 0, celsius);
+}
+
+// Program the window monitor of the already configured ADC
+void TemperatureZero::applyAlarmWindow() {
+  ADC->INTENCLR.reg = ADC_INTENCLR_WINMON;
+  bool hasLow = _alarmLow > 0;
+  bool hasHigh = _alarmHigh <= 4095;
+  if (!_isAlarmArmed || _alarmOwner != this || (!hasLow && !hasHigh)) {
+    // Without any limit within the range of the readings, the alarm can not fire
+    ADC->WINCTRL.reg = ADC_WINCTRL_WINMODE_DISABLE;
+    syncAdc();
+    return;
+  }
+  uint8_t mode;
+  if (hasLow && hasHigh) {
+    // Mode 4 flags every result outside of WINLT < RESULT < WINUT
+    ADC->WINLT.reg = _alarmLow - 1;
+    syncAdc();
+    ADC->WINUT.reg = _alarmHigh;
+    mode = ADC_WINCTRL_WINMODE_MODE4;
+  } else if (hasLow) {
+    // Mode 2 flags RESULT < WINUT
+    ADC->WINUT.reg = _alarmLow;
+    mode = ADC_WINCTRL_WINMODE_MODE2;
+  } else {
+    // Mode 1 flags RESULT > WINLT
+    ADC->WINLT.reg = _alarmHigh - 1;
+    mode = ADC_WINCTRL_WINMODE_MODE1;
+  }
+  syncAdc();
+  ADC->WINCTRL.reg = mode;
+  syncAdc();
+  ADC->INTFLAG.reg = ADC_INTFLAG_WINMON;
+  ADC->INTENSET.reg = ADC_INTENSET_WINMON;
+  NVIC_EnableIRQ(ADC_IRQn);
+}
+
+// Fire the alarm once the window monitor flagged a reading
+void TemperatureZero::serviceAlarm() {
+  if (!(ADC->INTFLAG.bit.WINMON)) {
+    return;
+  }
+  // The DMAC is triggered by the same result and has copied it long before this interrupt is entered
+  uint16_t adcReading = ADC->RESULT.reg;
+  ADC->INTENCLR.reg = ADC_INTENCLR_WINMON;
+  ADC->INTFLAG.reg = ADC_INTFLAG_WINMON;
+  _isAlarmArmed = false;
+  if (_alarmCallback != NULL) {
+    _alarmCallback(adcReading);
+  }
+}
+
+// Weak, so a strong ADC_Handler() elsewhere takes its place instead of clashing with it when linking.
+// It still replaces the weak default handler of the core, as the library objects are linked before it.
+__attribute__((weak)) void ADC_Handler(void) {
+  TemperatureZero::handleInterrupt();
+}
+
+// Weak like ADC_Handler(), e.g. the I2S library of the core and Adafruit_ZeroDMA define their own
+__attribute__((weak)) void DMAC_Handler(void) {
+  TemperatureZero::handleDmaInterrupt();
+}
+#endif
+
+#ifdef __SAMD51__
+// Start ADC0 conversion, and wait for the result
+static uint16_t convertAdc0() {
+  ADC0->SWTRIG.bit.START = 1;
+  while (ADC0->INTFLAG.bit.RESRDY == 0);   // Waiting for conversion to complete
+  uint16_t adcReading = ADC0->RESULT.reg;
+  ADC0->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  return adcReading;
+}
+
+// Get raw 12 bit adc readings of both temperature sensors
+void TemperatureZero::readInternalTemperatureRaw(uint16_t &ptat, uint16_t &ctat) {
+  TZ_STATS_BEGIN_READ();
+  powerUp();
+
+  // Save ADC settings
+  uint16_t oldEnable = ADC0->CTRLA.bit.ENABLE;
+  uint16_t oldReadResolution = ADC0->CTRLB.reg;
+  uint8_t oldSampling = ADC0->SAMPCTRL.reg;
+  uint8_t oldSampleAveraging = ADC0->AVGCTRL.reg;
+  uint16_t oldInput = ADC0->INPUTCTRL.reg;
+  uint8_t oldReference = ADC0->REFCTRL.reg;
+
+  ADC0->CTRLA.bit.ENABLE = 0;
+  syncAdc0(ADC_SYNCBUSY_ENABLE);
+  ADC0->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_12BIT_Val;
+  syncAdc0(ADC_SYNCBUSY_CTRLB);
+  // Ensure we are sampling slowly
+  ADC0->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(0x3f);
+  syncAdc0(ADC_SYNCBUSY_SAMPCTRL);
+  // The factory calibration values are taken with the internal reference
+  ADC0->REFCTRL.bit.REFSEL = ADC_REFCTRL_REFSEL_INTREF_Val;
+  syncAdc0(ADC_SYNCBUSY_REFCTRL);
+  ADC0->AVGCTRL.reg = averagingControl();
+  syncAdc0(ADC_SYNCBUSY_AVGCTRL);
+  ADC0->INPUTCTRL.reg = ADC_INPUTCTRL_MUXPOS_PTAT | ADC_INPUTCTRL_MUXNEG_GND;
+  syncAdc0(ADC_SYNCBUSY_INPUTCTRL);
+  ADC0->CTRLA.bit.ENABLE = 1;
+  syncAdc0(ADC_SYNCBUSY_ENABLE);
+
+  // The first conversion after the reference is changed must not be used.
+  ADC0->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  convertAdc0();
+  ptat = convertAdc0();
+  TZ_STATS_ADD(discardedConversions, 1);
+
+  ADC0->INPUTCTRL.reg = ADC_INPUTCTRL_MUXPOS_CTAT | ADC_INPUTCTRL_MUXNEG_GND;
+  syncAdc0(ADC_SYNCBUSY_INPUTCTRL);
+  ctat = convertAdc0();
+  TZ_STATS_ADD(conversions, 2);
+
+  // Restore previous ADC settings
+  ADC0->CTRLA.bit.ENABLE = 0;
+  syncAdc0(ADC_SYNCBUSY_ENABLE);
+  ADC0->CTRLB.reg = oldReadResolution;
+  ADC0->SAMPCTRL.reg = oldSampling;
+  ADC0->AVGCTRL.reg = oldSampleAveraging;
+  ADC0->INPUTCTRL.reg = oldInput;
+  ADC0->REFCTRL.reg = oldReference;
+  syncAdc0(ADC_SYNCBUSY_MASK);
+  ADC0->CTRLA.bit.ENABLE = oldEnable;
+  syncAdc0(ADC_SYNCBUSY_ENABLE);
+  powerDown();
+  TZ_STATS_END_READ();
+}
+#endif
@@ -10,6 +10,18 @@
 #ifndef TEMPERATUREZERO_h
 #define TEMPERATUREZERO_h
 
+#include "TemperatureFilter.h"
+#include "TemperatureZeroAdc.h"
+#include "TemperatureZeroMath.h"
+#include "TemperatureZeroSample.h"
+
+// Factory calibration of the chip the library is built for
+#ifdef __SAMD51__
+typedef TemperatureZeroSamd51Calibration TemperatureZeroCalibration;
+#else
+typedef TemperatureZeroSamd21Calibration TemperatureZeroCalibration;
+#endif
+
 #define TZ_AVERAGING_1   0
 #define TZ_AVERAGING_2   1
 #define TZ_AVERAGING_4   2
@@ -20,14 +32,196 @@
 #define TZ_AVERAGING_128 7
 #define TZ_AVERAGING_256 8
 
+// DMA channel used by startContinuous(). Like TZ_WITH_DEBUG_CODE, set it as a build flag
+// (or edit it here) when the channel is taken by another library.
+#ifndef TZ_DMA_CHANNEL
+#define TZ_DMA_CHANNEL 0
+#endif
+
+// Event system channel used by startScheduledSampling(), set it like TZ_DMA_CHANNEL
+#ifndef TZ_EVSYS_CHANNEL
+#define TZ_EVSYS_CHANNEL 0
+#endif
+
+// Event generator for startScheduledSampling(), from the RTC periodic interval n, at a frequency of
+// the RTC clock / 2^(n + 3), e.g. n = 7 gives 1 Hz, n = 0 gives 128 Hz with a 1.024 kHz RTC clock
+#define TZ_RTC_PERIODIC_EVENT(n) (EVSYS_ID_GEN_RTC_PER_0 + (n))
+
+// Power policies of setPowerPolicy()
+#define TZ_POWER_ALWAYS_ON 0 // the sensor stays enabled from init() on, until disable()
+#define TZ_POWER_ON_DEMAND 1 // enabled for each read, and disabled right after it
+#define TZ_POWER_AUTO_OFF  2 // enabled for a read, and disabled by servicePower() after an idle time
+
+// Time the temperature sensor gets after it was enabled, before a reading is taken
+// The datasheets give no start-up time, this leaves some margin on top of the discarded first conversion.
+#ifndef TZ_SENSOR_SETTLING_MICROS
+#define TZ_SENSOR_SETTLING_MICROS 100
+#endif
+
+// Maximum number of extra bits for readInternalTemperatureOversampled(), 4^4 = 256 readings
+#define TZ_OVERSAMPLING_MAX_BITS 4
+
+// Maximum number of points kept by saveUserCalibration() and by the RAM copy of initLazy()
+// The points themselves are held by the caller, see setUserCalibrationStorage().
+#ifndef TZ_CALIBRATION_MAX_POINTS
+#define TZ_CALIBRATION_MAX_POINTS 8
+#endif
+
+// RAM of one TemperatureZero object without TZ_WITH_DEBUG_CODE, in bytes, checked when building
+// It is fixed rather than a build flag: optional features keep their state in caller supplied storage,
+// like the lookup table, the calibration points and the adaptive averaging, or in the state shared by
+// all instances, like the ring buffer. Raising it is a change of its own, together with the README.
+#ifdef __SAMD51__
+#define TZ_OBJECT_SIZE_BUDGET 68
+#else
+#define TZ_OBJECT_SIZE_BUDGET 116
+#endif
+
+// Voltage of the bandgap reference, used by readInternalTemperatureCompensated()
+// The nominal 1.1 V is off by far more than the 1V reference estimate of the fuses, so by default (0)
+// the voltage is calibrated against that estimate on the first compensated reading.
+#ifndef TZ_BANDGAP_VOLTAGE
+#define TZ_BANDGAP_VOLTAGE 0
+#endif
+
+// Maximum number of analog pins converted by scan()
+#ifndef TZ_SCAN_MAX_PINS
+#define TZ_SCAN_MAX_PINS 4
+#endif
+
+// Number of float entries needed by enableLookupTable() for a stride of (1 << strideShift) adc steps
+// The full table (strideShift 0) holds every reading, sparser tables are interpolated linearly.
+#define TZ_LOOKUP_TABLE_SIZE(strideShift) ((strideShift) == 0 ? 4096 : (4095 >> (strideShift)) + 2)
+
+// Called with the raw 12 bit adc reading once a non-blocking conversion completes.
+// Note: this runs in interrupt context, so keep it short.
+typedef void (*TemperatureZeroCallback)(uint16_t adcReading);
+
+// Called with the ring buffer each time the DMAC has filled it completely, also from interrupt context.
+typedef void (*TemperatureZeroBufferCallback)(uint16_t *buffer, uint16_t length);
+
+#ifdef TZ_WITH_DEBUG_CODE
+// Number of records kept by the trace, the oldest records are overwritten
+#ifndef TZ_TRACE_LENGTH
+#define TZ_TRACE_LENGTH 16
+#endif
+
+enum TemperatureZeroTraceKind {
+  TZ_TRACE_CALIBRATION,
+  TZ_TRACE_CONVERSION
+};
+
+// Fixed size trace record, the meaning of raw and values depends on kind and chip:
+//   calibration SAMD21: room/hot reading, room/hot temperature, room/hot 1V ref, room/hot compensated voltage
+//   calibration SAMD51: -, room/hot temperature, room/hot PTAT reading, room/hot CTAT reading
+//   conversion SAMD21:  adc reading, coarse temperature, 1V ref estimate, compensated voltage, refined
+//                       temperature, result
+//   conversion SAMD51:  PTAT/CTAT reading, result
+struct TemperatureZeroTraceRecord {
+  uint8_t kind;
+  bool isUserCalEnabled;
+  uint16_t raw[2];
+  float values[6];
+};
+#endif
+
+// State of enableAdaptiveAveraging(), held by the caller so objects without it do not pay for it
+struct TemperatureZeroAdaptive {
+  float targetVariance;
+  uint32_t maxReadMicros;
+  float previous;  // last reading, for the difference to the next one
+  float noise;     // sum of the variance estimates of the current window
+  uint8_t count;   // readings in the current window
+};
+
+#ifdef TZ_WITH_STATS
+// Counters of the ADC work, only compiled in with TZ_WITH_STATS set as a build flag
+struct TemperatureZeroStats {
+  uint32_t reads;                // blocking reads, including readInternalTemperatureOversampled()
+  uint32_t conversions;          // conversions of which the result is used
+  uint32_t discardedConversions; // first conversions after the reference is changed
+  uint32_t syncWaits;            // waits for the register synchronization between the clock domains
+  uint32_t syncSpins;            // loop iterations spent in all those waits
+  uint32_t maxSyncSpins;         // loop iterations of the longest single wait
+  uint32_t busyMicros;           // total time spent in the blocking reads
+};
+#endif
+
+#ifndef __SAMD51__
+// Telemetry frame filled by scan()
+struct TemperatureZeroFrame {
+  float temperature;        // degrees, converted with raw2temp()
+  float coreVoltage;        // VDDCORE in V
+  float ioVoltage;          // VDDIO in V
+  uint16_t temperatureRaw;
+  uint16_t coreVoltageRaw;  // 1/4 scaled VDDCORE, 12 bit against the internal 1V reference
+  uint16_t ioVoltageRaw;    // 1/4 scaled VDDIO, 12 bit against the internal 1V reference
+  uint8_t pinCount;
+  uint16_t pinReadings[TZ_SCAN_MAX_PINS]; // in the resolution and reference analogRead() uses
+};
+
+// Version of TemperatureZeroCalibrationRecord, records of other versions are ignored
+#define TZ_CALIBRATION_VERSION 2
+
+// Calibration kept in flash by saveUserCalibration(), with the coefficients derived from it, so
+// loadUserCalibration() does not need to recompute anything. It only applies to the chip with the
+// same factory calibration fuses, and is checked by a CRC-32 over all fields before crc.
+// initLazy() keeps one in RAM as well, with a cheaper checksum in crc.
+struct TemperatureZeroCalibrationRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint32_t fuses[2];        // factory calibration words the coefficients were derived from
+  float userCalGainCorrection;
+  float userCalOffsetCorrection;
+  float bandgapVoltage;
+  TemperatureZeroQuadratic conversion;
+  TemperatureZeroLinear compensated;
+  TemperatureZeroFixedQuadratic factoryMilliC;
+  int32_t userCalGainCorrectionQ16;
+  int32_t userCalOffsetCorrectionMilliC;
+  uint8_t isUserCalEnabled;
+  uint8_t userCalPointCount;
+  uint8_t reserved[2];
+  float userCalMeasurements[TZ_CALIBRATION_MAX_POINTS];
+  float userCalGroundTruths[TZ_CALIBRATION_MAX_POINTS];
+  uint32_t crc;
+};
+
+// The record is written into a single flash row, which takes up to 22 calibration points
+static_assert(sizeof(TemperatureZeroCalibrationRecord) <= FLASH_PAGE_SIZE * NVMCTRL_ROW_PAGES,
+              "TZ_CALIBRATION_MAX_POINTS is too large for the calibration record to fit a flash row");
+
+// Placement of the RAM copy of the calibration of initLazy(). By default it is cleared at startup, so the
+// copy only saves the work when initLazy() runs again without a reset, e.g. after sleeping.
+// The linker scripts of the Arduino SAMD core have no section the startup code leaves alone, so keeping
+// the copy across resets is opt-in: add one to a copy of the linker script of the board, after .bss and
+// before the end symbol the heap starts at:
+//   .noinit (NOLOAD) : { . = ALIGN(4); *(.noinit*) . = ALIGN(4); } > RAM
+// and build with -DTZ_NOINIT='__attribute__((section(".noinit")))'.
+#ifndef TZ_NOINIT
+#define TZ_NOINIT
+#endif
+#endif
+
+template <class Config> class TemperatureZeroT;
+
 class TemperatureZero
 {
   public:
     TemperatureZero();
     void init();
+    void initLazy();
     void wakeup();
     void disable();
+    bool isSensorEnabled();
+    void setPowerPolicy(uint8_t policy, uint16_t idleMillis = 0);
+    uint8_t getPowerPolicy();
+    void servicePower();
     void setAveraging(uint8_t averaging);
+    uint8_t getAveraging();
+    void enableAdaptiveAveraging(TemperatureZeroAdaptive &adaptive, float targetVariance, uint32_t maxReadMicros);
+    void disableAdaptiveAveraging();
     void setUserCalibration2P(float userCalColdGroundTruth,
                             float userCalColdMeasurement,
                             float userCalHotGroundTruth,
@@ -36,55 +230,281 @@ class TemperatureZero
     void setUserCalibration(float userCalGainCorrection,
                             float userCalOffsetCorrection,
                             bool isEnabled);
+    void setUserCalibrationStorage(TemperatureZeroCalibrationPoint *points, uint8_t capacity);
+    bool setUserCalibrationPoints(const float *groundTruths,
+                                  const float *measurements,
+                                  uint8_t count,
+                                  bool isEnabled);
     void enableUserCalibration();
     void disableUserCalibration();
-    uint16_t readInternalTemperatureRaw();
-
-    float raw2temp (uint16_t adcReading);
+    float readInternalTemperature();
+    float readInternalTemperature(uint32_t maxAgeMillis, bool isBackground = false);
+    uint32_t lastReadingTimestamp();
+    void setCoalescingWindow(uint16_t windowMillis);
+    bool getLastTemperature(float &temperature, uint32_t &ageMillis);
+    void setFilter(TemperatureFilterBase *filter);
 
 #ifdef __SAMD51__
+    void readInternalTemperatureRaw(uint16_t &ptat, uint16_t &ctat);
     float raw2temp(uint16_t TP, uint16_t TC);
+    void raw2temp(const uint16_t *TP, const uint16_t *TC, float *temperatures, size_t count);
+#else
+    void initMilliC();
+    uint16_t readInternalTemperatureRaw();
+    uint32_t readInternalTemperatureOversampled(uint8_t extraBits);
+    void readCompensatedRaw(uint16_t &adcReading, uint16_t &bandgapReading);
+    float readInternalTemperatureCompensated();
+    float raw2tempCompensated(uint16_t adcReading, uint16_t bandgapReading);
+    void setBandgapVoltage(float bandgapVoltage);
+    bool saveUserCalibration();
+    bool loadUserCalibration();
+    void eraseUserCalibration();
+    bool beginSession();
+    void endSession();
+    bool isSessionActive();
+    bool startConversion();
+    bool isConversionReady();
+    uint16_t getResult();
+    void setConversionCallback(TemperatureZeroCallback callback);
+    static void handleInterrupt();
+    bool startContinuous(uint16_t *buffer, uint16_t length);
+    bool startScheduledSampling(uint16_t *buffer, uint16_t length, uint8_t eventGenerator,
+                                TemperatureZeroBufferCallback callback);
+    bool scan(TemperatureZeroFrame &frame, const uint8_t *pins, uint8_t pinCount);
+    void readSample(TemperatureZeroSample &sample);
+    uint16_t readSamples(TemperatureZeroSample *destination, uint16_t count);
+    void stopContinuous();
+    bool isContinuousActive();
+    uint16_t getBufferHead();
+    uint16_t getBufferTail();
+    uint16_t getBufferAvailable();
+    uint16_t readBuffer(uint16_t *destination, uint16_t count);
+    void consumeBuffer(uint16_t count);
+    uint32_t getOverrunCount();
+    static void handleDmaInterrupt();
+    bool setAlarmWindow(float lowC, float highC, TemperatureZeroCallback callback);
+    void clearAlarmWindow();
+    bool isAlarmArmed();
+
+    float raw2temp (uint16_t adcReading);
+    void raw2temp(const uint16_t *adcReadings, float *temperatures, size_t count);
+    float raw2temp(uint32_t oversampledReading, uint8_t extraBits);
+    bool enableLookupTable(float *table, uint16_t size, uint8_t strideShift);
+    void disableLookupTable();
+    int32_t raw2milliC(uint16_t adcReading);
+    int32_t readInternalTemperatureMilliC();
+#endif
+#ifdef TZ_WITH_STATS
+    static TemperatureZeroStats getStats();
+    static void resetStats();
 #endif
-    float readInternalTemperature();
 #ifdef TZ_WITH_DEBUG_CODE
     void enableDebugging(Stream &debugPort);
     void disableDebugging(void); 
+    void enableTrace();
+    void disableTrace();
+    void clearTrace();
+    void dumpTrace(Stream &debugPort);
 #endif
   
   private:
+    friend class TemperatureZeroBench;
+    friend class TemperatureZeroAdc;
+    template <class Config> friend class TemperatureZeroT;
 #ifdef TZ_WITH_DEBUG_CODE
     bool _debug;
     Stream * _debugSerial;
+    bool _isTracing;
+    TemperatureZeroTraceRecord _trace[TZ_TRACE_LENGTH];
+    uint8_t _traceNext;
+    uint8_t _traceCount;
+    TemperatureZeroTraceRecord &addTraceRecord(uint8_t kind);
+    void printTraceRecord(Stream &debugPort, const TemperatureZeroTraceRecord &record);
 #endif
-    uint8_t _averaging;
+    // Members are grouped by size, so the object has no padding, see TZ_OBJECT_SIZE_BUDGET
+    TemperatureFilterBase *_filter;
+    TemperatureZeroAdaptive *_adaptive;
+    float _userCalGainCorrection;
+    float _userCalOffsetCorrection;
+    uint32_t _sensorEnableMicros;
+    uint32_t _lastUseMillis;
+    // Last result of readInternalTemperature(), shared by all callers, see setCoalescingWindow()
+    float _lastTemperature;
+    uint32_t _lastReadingMillis;
+
+    // Piecewise linear user calibration, in caller supplied storage, segment i runs from point i to i + 1,
+    // and the outer segments extend beyond the first and last point
+    TemperatureZeroCalibrationPoint *_userCalPoints;
+
+#ifdef __SAMD51__
+    // Conversion coefficients, see updateCoefficients()
+    TemperatureZeroRational _rational;
+#else
+    TemperatureZeroQuadratic _conversion;
+    TemperatureZeroLinear _compensated;
+    float _bandgapVoltage;
+
+    float *_lookupTable;
+    float _lookupFractionScale;
+
+    // Integer path, in milli degrees
+    TemperatureZeroFixedQuadratic _milliC;
+    int32_t _userCalGainCorrectionQ16;
+    int32_t _userCalOffsetCorrectionMilliC;
+
+    TemperatureZeroCallback _conversionCallback;
+    static TemperatureZero * volatile _activeConversion;
 
-    float _roomTemperature;
-    uint16_t _roomReading;
-    float _hotTemperature;
-    uint16_t _hotReading;
-    float _roomInt1vRef;
-    float _hotInt1vRef;
-    float _roomVoltageCompensated;
-    float _hotVoltageCompensated;
-
-    uint32_t TLI;
-    uint32_t TLD;
-    float TL;
-    uint32_t THI;
-    uint32_t THD;
-    float TH;
-    uint16_t VPL;
-    uint16_t VPH;
-    uint16_t VCL;
-    uint16_t VCH;
+    static TemperatureZero * volatile _activeContinuous;
+    static volatile uint8_t _blockingClaims;  // blocking reads holding the ADC, see claimAdc()
 
+    // The ring buffer and its alarm, shared by all instances like the DMA channel and the ADC, so they
+    // do not take up RAM in every object. The samples of a stopped buffer stay with its owner until
+    // another buffer starts.
+    static TemperatureZero *_bufferOwner;
+    static uint16_t *_buffer;
+    static volatile uint32_t _bufferWraps;
+    static uint32_t _bufferWritten;
+    static uint32_t _bufferConsumed;
+    static uint32_t _overrunCount;
+    // Timestamp interpolation of readSamples(), from the last sample it returned to the newest one
+    static uint32_t _bufferAnchorMicros;
+    static uint32_t _bufferAnchorWritten;
+    static uint32_t _bufferStopMicros;
+    static TemperatureZeroBufferCallback _bufferCallback;
+    static uint16_t _bufferLength;
+    static uint8_t _scheduledGenerator; // Event generator of startScheduledSampling(), 0 when free running
+    static TemperatureZero *_alarmOwner;
+    static TemperatureZeroCallback _alarmCallback;
+    static uint16_t _alarmLow;
+    static uint16_t _alarmHigh;
+    static volatile bool _isAlarmArmed;
+
+    volatile uint16_t _conversionResult;
+
+    enum {
+      TZ_CONVERSION_IDLE,
+      TZ_CONVERSION_DISCARD,
+      TZ_CONVERSION_BUSY,
+      TZ_CONVERSION_READY
+    };
+    volatile uint8_t _conversionState;
+    bool _isSessionActive;
+    uint8_t _sessionAveraging;
+    uint8_t _lookupStrideShift;
+#endif
+
+    uint16_t _powerIdleMillis;
+    uint16_t _coalescingMillis;
+    uint16_t _readingSequence;  // counts the readings of readInternalTemperature(), 0 before the first
+    uint8_t _powerPolicy;
+    bool _isSensorSettling;
+    uint8_t _averaging;
     bool _isUserCalEnabled;
-    float _userCalGainCorrection;
-    float _userCalOffsetCorrection;
-    
-    void getFactoryCalibration();
-    float convertDecToFrac(uint8_t);
+    bool _isUserCalPiecewise;
+    uint8_t _userCalPointCount;
+    uint8_t _userCalPointCapacity;
+    bool _isCalibrationPending;
+#ifndef __SAMD51__
+    bool _isMilliCPending;  // the integer coefficients of initLazy() are still to be derived
+    bool _isRefreshing;  // a non-blocking conversion of readInternalTemperature(maxAgeMillis, true) is pending
+#endif
+
+    uint8_t averagingControl();
+    void adaptAveraging(float temperature, uint32_t readMicros);
+#ifdef TZ_WITH_DEBUG_CODE
+    void traceFactoryCalibration();
+#endif
+#ifdef __SAMD51__
+    static TemperatureZeroSamd51Fuses readFuses();
+#else
+    static TemperatureZeroSamd21Fuses readFuses();
+#endif
+    void updateCoefficients();
+    void updateUserCalibration();
+    float applyUserCalibrationPoints(float temperature);
+    void initState();
+    void completeInit();
+    void powerUp();
+    void powerDown();
+    bool isSensorInUse();
+    void lockAdc();
+    void unlockAdc();
+    void storeReading(float temperature);
+    // Complete initLazy() before the coefficients are used
+    inline void ensureCalibration() {
+      if (_isCalibrationPending) {
+        completeInit();
+      }
+    }
+#ifndef __SAMD51__
+    void buildLookupTable();
+    float lookupTemperature(uint16_t adcReading);
+    void updateFixedPointCoefficients(const TemperatureZeroFixedQuadratic &factoryMilliC);
+    void completeInitMilliC();
+    // Complete initLazy() for the integer path only, without going through the float completeInit()
+    inline void ensureMilliC() {
+      if (_isMilliCPending) {
+        completeInitMilliC();
+      }
+    }
+    uint16_t readTemperatureRaw();
+    float completeRefresh();
+    static TemperatureZeroAdcSettings adcSettings(uint8_t averaging);
+    void switchAdc(TemperatureZeroAdcSettings settings);
+    static uint32_t *calibrationRow();
+    bool fillCalibrationRecord(TemperatureZeroCalibrationRecord &record, uint32_t magic);
+    bool isCalibrationRecordValid(const TemperatureZeroCalibrationRecord &record, uint32_t magic);
+    void applyCalibrationRecord(const TemperatureZeroCalibrationRecord &record);
+    static uint32_t calibrationCrc(const TemperatureZeroCalibrationRecord &record);
+    static void writeCalibrationRow(const uint32_t *words, uint16_t count);
+    static void scanChannels(TemperatureZeroAdcSettings settings, uint8_t firstChannel, uint8_t count, uint16_t *readings);
+    static bool claimAdc();
+    static void unclaimAdc();
+    static bool readLatestSample(uint16_t &adcReading);
+    bool claimRead();
+    void unclaimRead();
+#endif
+    bool configureAdc();
+    void applyAveraging();
+    void discardConversion();
+    uint16_t convert();
+    void restoreAdcSettings();
+    void serviceConversion();
+    uint32_t getBufferWritten();
+    bool startBuffer(uint16_t *buffer, uint16_t length, TemperatureZeroBufferCallback callback);
+    uint16_t temp2raw(float celsius);
+    void applyAlarmWindow();
+    void serviceAlarm();
+};
+
+#ifndef __SAMD51__
+// Keeps a TemperatureZero session open for as long as it is in scope, e.g.
+//   {
+//     TemperatureZeroSession session(TempZero);
+//     for (...) TempZero.readInternalTemperature();
+//   }
+// Does nothing when a session was already active, or could not begin as a buffer holds the ADC.
+class TemperatureZeroSession
+{
+  public:
+    TemperatureZeroSession(TemperatureZero &sensor) : _sensor(sensor) {
+      _isOwner = !_sensor.isSessionActive();
+      if (_isOwner) {
+        _isOwner = _sensor.beginSession();
+      }
+    }
+    ~TemperatureZeroSession() {
+      if (_isOwner) {
+        _sensor.endSession();
+      }
+    }
+
+  private:
+    TemperatureZero &_sensor;
+    bool _isOwner;
 };
+#endif
 
 #endif
 
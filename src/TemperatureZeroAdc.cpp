@@ -0,0 +1,273 @@
+/*
+  TemperatureZeroAdc.cpp - Arbitration of the shared SAMD21 ADC between TemperatureZero and analogRead() -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include "Arduino.h"
+#include "TemperatureZeroAdc.h"
+#include "TemperatureZero.h"
+
+#ifndef __SAMD51__
+#include "wiring_private.h"
+
+uint8_t TemperatureZeroAdc::_users = 0;
+bool TemperatureZeroAdc::_isOwned = false;
+bool TemperatureZeroAdc::_isCurrentValid = false;
+bool TemperatureZeroAdc::_keepConfigured = false;
+bool TemperatureZeroAdc::_wasEnabled = false;
+TemperatureZeroAdcSettings TemperatureZeroAdc::_saved;
+TemperatureZeroAdcSettings TemperatureZeroAdc::_current;
+TemperatureZeroAdc::Request TemperatureZeroAdc::_queue[TZ_ADC_QUEUE_LENGTH];
+uint8_t TemperatureZeroAdc::_queueLength = 0;
+TemperatureZeroLockHook TemperatureZeroAdc::_lock = NULL;
+TemperatureZeroLockHook TemperatureZeroAdc::_unlock = NULL;
+
+#ifdef TZ_WITH_STATS
+uint32_t TemperatureZeroAdc::_syncWaits = 0;
+uint32_t TemperatureZeroAdc::_syncSpins = 0;
+uint32_t TemperatureZeroAdc::_maxSyncSpins = 0;
+
+// Account a finished wait for the ADC synchronization
+void TemperatureZeroAdc::addSyncSpins(uint32_t spins) {
+  _syncWaits++;
+  _syncSpins += spins;
+  if (spins > _maxSyncSpins) {
+    _maxSyncSpins = spins;
+  }
+}
+#endif
+
+// Take the ADC for a series of configure() and convert() calls, until release()
+// The first user saves the complete settings of the sketch, later users share the ADC.
+void TemperatureZeroAdc::acquire() {
+  noInterrupts();
+  _users++;
+  if (!_isOwned) {
+    readSettings(_saved);
+    _wasEnabled = ADC->CTRLA.bit.ENABLE;
+    _current = _saved;
+    _isCurrentValid = true;
+    _isOwned = true;
+  } else if (_users == 1) {
+    // Kept configured since the last release(), make sure nobody changed the ADC meanwhile
+    TemperatureZeroAdcSettings settings;
+    readSettings(settings);
+    _isCurrentValid = _isCurrentValid && isCurrent(settings);
+  }
+  interrupts();
+}
+
+// Setup the acquired ADC and enable it, writing only the registers that differ from the current setup
+// Returns true when the first conversion must be discarded, as the ADC was disabled or the
+// reference or gain was changed.
+bool TemperatureZeroAdc::configure(const TemperatureZeroAdcSettings &settings) {
+  bool isEnabled = ADC->CTRLA.bit.ENABLE;
+  bool isReferenceChanged = !_isCurrentValid || settings.reference != _current.reference ||
+                            (settings.input & ADC_INPUTCTRL_GAIN_Msk) != (_current.input & ADC_INPUTCTRL_GAIN_Msk);
+  if (!_isCurrentValid || settings.control != _current.control) {
+    ADC->CTRLB.reg = settings.control;
+    sync();
+  }
+  if (!_isCurrentValid || settings.sampling != _current.sampling) {
+    ADC->SAMPCTRL.reg = settings.sampling;
+    sync();
+  }
+  if (!_isCurrentValid || settings.averaging != _current.averaging) {
+    ADC->AVGCTRL.reg = settings.averaging;
+    sync();
+  }
+  if (!_isCurrentValid || settings.input != _current.input) {
+    ADC->INPUTCTRL.reg = settings.input;
+    sync();
+  }
+  if (isReferenceChanged) {
+    ADC->REFCTRL.reg = settings.reference;
+    sync();
+  }
+  _current = settings;
+  _isCurrentValid = true;
+  if (!isEnabled) {
+    ADC->CTRLA.bit.ENABLE = 1;
+    sync();
+  }
+  return isReferenceChanged || !isEnabled;
+}
+
+// Hand the ADC back after acquire()
+// The last user restores the settings of the sketch, unless setKeepConfigured() is on.
+void TemperatureZeroAdc::release() {
+  noInterrupts();
+  if (_users > 0) {
+    _users--;
+  }
+  bool isLast = _users == 0;
+  interrupts();
+  if (isLast && !_keepConfigured) {
+    restore();
+  }
+}
+
+// Leave the ADC configured after the last release(), so the next read skips the setup and the
+// discarded first conversion. Only use this when nothing else uses the ADC, or call restore()
+// before analogRead() or any other library that uses the ADC.
+void TemperatureZeroAdc::setKeepConfigured(bool keepConfigured) {
+  _keepConfigured = keepConfigured;
+  if (!keepConfigured) {
+    restore();
+  }
+}
+
+// Put back the complete settings saved by the first acquire(), including the enable state
+void TemperatureZeroAdc::restore() {
+  noInterrupts();
+  if (!_isOwned || _users > 0) {
+    interrupts();
+    return;
+  }
+  _isOwned = false;
+  interrupts();
+  ADC->CTRLA.bit.ENABLE = 0;
+  sync();
+  ADC->CTRLB.reg = _saved.control;
+  sync();
+  ADC->SAMPCTRL.reg = _saved.sampling;
+  sync();
+  ADC->AVGCTRL.reg = _saved.averaging;
+  sync();
+  ADC->INPUTCTRL.reg = _saved.input;
+  sync();
+  ADC->REFCTRL.reg = _saved.reference;
+  sync();
+  if (_wasEnabled) {
+    ADC->CTRLA.bit.ENABLE = 1;
+    sync();
+  }
+}
+
+// Run a single conversion on the configured ADC
+uint16_t TemperatureZeroAdc::convert() {
+  ADC->SWTRIG.bit.START = 1;
+  while (!(ADC->INTFLAG.bit.RESRDY));
+  sync();
+  uint16_t adcReading = ADC->RESULT.reg;
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  sync();
+  return adcReading;
+}
+
+// Settings for an analog pin, with the resolution, reference and averaging analogRead() would use
+// Also switches the pin to its analog function, like analogRead() does.
+TemperatureZeroAdcSettings TemperatureZeroAdc::pinSettings(uint8_t pin) {
+  TemperatureZeroAdcSettings settings;
+  if (_isOwned) {
+    settings = _saved;
+  } else {
+    readSettings(settings);
+  }
+  pinPeripheral(pin, PIO_ANALOG);
+  settings.input = (settings.input & ADC_INPUTCTRL_GAIN_Msk) |
+                   ADC_INPUTCTRL_MUXPOS(g_APinDescription[pin].ulADCChannelNumber) | ADC_INPUTCTRL_MUXNEG_GND;
+  return settings;
+}
+
+// Add a conversion to the queue, the result is stored in result by runQueue()
+// Returns false when the queue already holds TZ_ADC_QUEUE_LENGTH conversions.
+bool TemperatureZeroAdc::queue(const TemperatureZeroAdcSettings &settings, uint16_t *result) {
+  if (_queueLength >= TZ_ADC_QUEUE_LENGTH || result == NULL) {
+    return false;
+  }
+  _queue[_queueLength].settings = settings;
+  _queue[_queueLength].result = result;
+  _queueLength++;
+  return true;
+}
+
+// Convert all queued conversions in one acquire(), grouped by configuration
+// Conversions with the same reference, gain, resolution, sampling and averaging follow each other,
+// so between them only the channel changes. Returns the number of conversions done, 0 while a
+// TemperatureZero buffer holds the ADC, the queue is then kept for a later runQueue().
+uint8_t TemperatureZeroAdc::runQueue() {
+  uint8_t count = _queueLength;
+  if (count == 0) {
+    return 0;
+  }
+  // Stable insertion sort, as the queue is short
+  for (uint8_t i = 1; i < count; i++) {
+    Request request = _queue[i];
+    uint8_t j = i;
+    while (j > 0 && compareGroups(_queue[j - 1].settings, request.settings) > 0) {
+      _queue[j] = _queue[j - 1];
+      j--;
+    }
+    _queue[j] = request;
+  }
+
+  lock();
+  if (!TemperatureZero::claimAdc()) {
+    unlock();
+    return 0;
+  }
+  acquire();
+  for (uint8_t i = 0; i < count; i++) {
+    if (configure(_queue[i].settings)) {
+      // The first conversion after the reference is changed must not be used.
+      convert();
+    }
+    *_queue[i].result = convert();
+  }
+  release();
+  TemperatureZero::unclaimAdc();
+  unlock();
+  _queueLength = 0;
+  return count;
+}
+
+// Serialize the blocking ADC work of the library between tasks of an RTOS
+// The lock is taken around every blocking read, scan() and runQueue(), and for the whole of a
+// TemperatureZero session. It is never taken from an interrupt, nor twice by the same read, so a plain
+// (non recursive) mutex will do. The non-blocking conversions and buffers complete in interrupts, so
+// they do not take the lock. Within it, the blocking work waits for a pending conversion instead, takes
+// the latest sample of a running buffer, and keeps both from starting meanwhile, see
+// TemperatureZero::claimAdc(). Pass NULL for both to remove the hooks again.
+// Note: queue() is not locked, queue and run the conversions from a single task.
+void TemperatureZeroAdc::setLockHooks(TemperatureZeroLockHook lock, TemperatureZeroLockHook unlock) {
+  _lock = lock;
+  _unlock = unlock;
+}
+
+void TemperatureZeroAdc::readSettings(TemperatureZeroAdcSettings &settings) {
+  settings.control = ADC->CTRLB.reg;
+  settings.sampling = ADC->SAMPCTRL.reg;
+  settings.averaging = ADC->AVGCTRL.reg;
+  settings.input = ADC->INPUTCTRL.reg;
+  settings.reference = ADC->REFCTRL.reg;
+}
+
+bool TemperatureZeroAdc::isCurrent(const TemperatureZeroAdcSettings &settings) {
+  return settings.control == _current.control && settings.sampling == _current.sampling &&
+         settings.averaging == _current.averaging && settings.input == _current.input &&
+         settings.reference == _current.reference;
+}
+
+// Order of the configurations in runQueue(), the reference first as changing it costs a conversion
+int8_t TemperatureZeroAdc::compareGroups(const TemperatureZeroAdcSettings &a, const TemperatureZeroAdcSettings &b) {
+  uint32_t gainA = a.input & ADC_INPUTCTRL_GAIN_Msk;
+  uint32_t gainB = b.input & ADC_INPUTCTRL_GAIN_Msk;
+  if (a.reference != b.reference) {
+    return a.reference < b.reference ? -1 : 1;
+  }
+  if (gainA != gainB) {
+    return gainA < gainB ? -1 : 1;
+  }
+  if (a.control != b.control) {
+    return a.control < b.control ? -1 : 1;
+  }
+  if (a.sampling != b.sampling) {
+    return a.sampling < b.sampling ? -1 : 1;
+  }
+  if (a.averaging != b.averaging) {
+    return a.averaging < b.averaging ? -1 : 1;
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,106 @@
+/*
+  TemperatureZeroAdc.h - Arbitration of the shared SAMD21 ADC between TemperatureZero and analogRead() -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZEROADC_h
+#define TEMPERATUREZEROADC_h
+
+#include "Arduino.h"
+
+#ifndef __SAMD51__
+
+// Number of conversions queue() can hold until runQueue()
+#ifndef TZ_ADC_QUEUE_LENGTH
+#define TZ_ADC_QUEUE_LENGTH 8
+#endif
+
+// Complete configuration of the ADC for one conversion
+struct TemperatureZeroAdcSettings {
+  uint16_t control;    // CTRLB: resolution and prescaler
+  uint8_t sampling;    // SAMPCTRL
+  uint8_t averaging;   // AVGCTRL
+  uint32_t input;      // INPUTCTRL: gain and channels
+  uint8_t reference;   // REFCTRL
+};
+
+// Called to lock and unlock the ADC against other tasks, e.g. taking and giving a FreeRTOS mutex
+typedef void (*TemperatureZeroLockHook)();
+
+// Owner of the ADC for the library: the settings of the sketch (as used by analogRead()) are saved
+// once, when the first user acquires the ADC, and restored completely when the last one releases it.
+// In between, configure() only writes the registers that differ from the current configuration.
+class TemperatureZeroAdc
+{
+  public:
+    static void acquire();
+    static bool configure(const TemperatureZeroAdcSettings &settings);
+    static void release();
+    static void setKeepConfigured(bool keepConfigured);
+    static void restore();
+    static uint16_t convert();
+    static TemperatureZeroAdcSettings pinSettings(uint8_t pin);
+    static bool queue(const TemperatureZeroAdcSettings &settings, uint16_t *result);
+    static uint8_t runQueue();
+    static void setLockHooks(TemperatureZeroLockHook lock, TemperatureZeroLockHook unlock);
+
+    // Take the lock of setLockHooks(), around blocking ADC work such as analogRead() in a task
+    static inline void lock() {
+      if (_lock != NULL) {
+        _lock();
+      }
+    }
+
+    static inline void unlock() {
+      if (_unlock != NULL) {
+        _unlock();
+      }
+    }
+
+    // Wait for synchronization of registers between the clock domains
+    static inline void sync() {
+#ifdef TZ_WITH_STATS
+      uint32_t spins = 0;
+      while (ADC->STATUS.bit.SYNCBUSY == 1) {
+        spins++;
+      }
+      addSyncSpins(spins);
+#else
+      while (ADC->STATUS.bit.SYNCBUSY == 1);
+#endif
+    }
+
+  private:
+    friend class TemperatureZero;
+
+    struct Request {
+      TemperatureZeroAdcSettings settings;
+      uint16_t *result;
+    };
+
+    static uint8_t _users;
+    static bool _isOwned;
+    static bool _isCurrentValid;
+    static bool _keepConfigured;
+    static bool _wasEnabled;
+    static TemperatureZeroAdcSettings _saved;
+    static TemperatureZeroAdcSettings _current;
+    static Request _queue[TZ_ADC_QUEUE_LENGTH];
+    static uint8_t _queueLength;
+    static TemperatureZeroLockHook _lock;
+    static TemperatureZeroLockHook _unlock;
+
+    static void readSettings(TemperatureZeroAdcSettings &settings);
+    static bool isCurrent(const TemperatureZeroAdcSettings &settings);
+    static int8_t compareGroups(const TemperatureZeroAdcSettings &a, const TemperatureZeroAdcSettings &b);
+
+#ifdef TZ_WITH_STATS
+    static uint32_t _syncWaits;
+    static uint32_t _syncSpins;
+    static uint32_t _maxSyncSpins;
+    static void addSyncSpins(uint32_t spins);
+#endif
+};
+
+#endif
+#endif
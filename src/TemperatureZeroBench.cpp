@@ -0,0 +1,208 @@
+/*
+  TemperatureZeroBench.cpp - Timing and noise characterization of the TemperatureZero library -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include "Arduino.h"
+#include "TemperatureZeroBench.h"
+
+// Keeps the compiler from dropping conversions of which the result is not used
+static volatile float _sink;
+
+TemperatureZeroBench::TemperatureZeroBench(TemperatureZero &sensor) : _sensor(sensor) {
+  _overhead = 0;
+  _readingCount = 0;
+}
+
+// Start the cycle counter, only needed for calling cycles() outside of run()
+void TemperatureZeroBench::beginCycles() {
+#ifdef __SAMD51__
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+// Current CPU cycle count, wrapping around at 2^32
+// The Cortex-M4 of the SAMD51 has the DWT cycle counter. The Cortex-M0+ of the SAMD21 has none,
+// so there the SysTick counter, which the core reloads every millisecond, is extended with millis().
+// A reload of which the interrupt is still pending, e.g. with interrupts disabled, is not counted by
+// millis() yet, so it is added here, like micros() of the core does.
+uint32_t TemperatureZeroBench::cycles() {
+#ifdef __SAMD51__
+  return DWT->CYCCNT;
+#else
+  uint32_t reload = (SysTick->LOAD & SysTick_LOAD_RELOAD_Msk) + 1;
+  uint32_t ticks;
+  uint32_t count;
+  bool isPending;
+  do {
+    ticks = millis();
+    count = SysTick->VAL;
+    isPending = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0;
+  } while (ticks != millis());
+  // The counter counts down, right after a reload it is high, so the pending reload came before it was read
+  if (isPending && count > reload / 2) {
+    ticks++;
+  }
+  return ticks * reload + (reload - 1 - count);
+#endif
+}
+
+// Print a CSV table with the cycles per call of each code path, and the noise per averaging mode
+// Columns: path, averaging, calls, cycles_min, cycles_avg, cycles_max, temperature_avg, temperature_var
+// The reads are timed for every averaging mode, the conversions once, from the readings taken.
+// The sensor itself must be initialized with init(), its averaging is restored afterwards.
+void TemperatureZeroBench::run(Print &out, uint16_t iterations) {
+  if (iterations == 0) {
+    return;
+  }
+  beginCycles();
+  // Cost of the time measurement itself, subtracted from every call
+  uint32_t start = cycles();
+  _overhead = cycles() - start;
+
+  out.println(F("path,averaging,calls,cycles_min,cycles_avg,cycles_max,temperature_avg,temperature_var"));
+  benchReads(out, iterations);
+  benchConversions(out, iterations);
+}
+
+void TemperatureZeroBench::benchReads(Print &out, uint16_t iterations) {
+  uint8_t averaging = _sensor.getAveraging();
+  Row row;
+  for (uint8_t mode = TZ_AVERAGING_1; mode <= TZ_AVERAGING_256; mode++) {
+    _sensor.setAveraging(mode);
+    _readingCount = 0;
+    beginRow(row);
+    for (uint16_t i = 0; i < iterations; i++) {
+#ifdef __SAMD51__
+      uint16_t ptat;
+      uint16_t ctat;
+      uint32_t start = cycles();
+      _sensor.readInternalTemperatureRaw(ptat, ctat);
+      uint32_t end = cycles();
+      float temperature = _sensor.raw2temp(ptat, ctat);
+      if (_readingCount < TZ_BENCH_READINGS) {
+        _ptatReadings[_readingCount] = ptat;
+        _ctatReadings[_readingCount++] = ctat;
+      }
+#else
+      uint32_t start = cycles();
+      uint16_t adcReading = _sensor.readInternalTemperatureRaw();
+      uint32_t end = cycles();
+      float temperature = _sensor.raw2temp(adcReading);
+      if (_readingCount < TZ_BENCH_READINGS) {
+        _readings[_readingCount++] = adcReading;
+      }
+#endif
+      addToRow(row, start, end, 1, temperature);
+    }
+    printRow(out, "readInternalTemperatureRaw", 1 << mode, row);
+  }
+  _sensor.setAveraging(averaging);
+}
+
+void TemperatureZeroBench::benchConversions(Print &out, uint16_t iterations) {
+  Row row;
+  beginRow(row);
+  for (uint16_t i = 0; i < iterations; i++) {
+    uint16_t index = i % _readingCount;
+    uint32_t start = cycles();
+#ifdef __SAMD51__
+    float temperature = _sensor.raw2temp(_ptatReadings[index], _ctatReadings[index]);
+#else
+    float temperature = _sensor.raw2temp(_readings[index]);
+#endif
+    uint32_t end = cycles();
+    _sink = temperature;
+    addToRow(row, start, end, 1, temperature);
+  }
+  printRow(out, "raw2temp", 0, row);
+
+  beginRow(row);
+  for (uint16_t i = 0; i < iterations; i++) {
+    uint32_t start = cycles();
+#ifdef __SAMD51__
+    _sensor.raw2temp(_ptatReadings, _ctatReadings, _temperatures, _readingCount);
+#else
+    _sensor.raw2temp(_readings, _temperatures, _readingCount);
+#endif
+    uint32_t end = cycles();
+    addToRow(row, start, end, _readingCount, _temperatures[i % _readingCount]);
+  }
+  printRow(out, "raw2temp_batch", 0, row);
+
+#ifndef __SAMD51__
+  // Time the lookup on a table of the benchmark, leaving the table of the sketch in place
+  static float table[TZ_LOOKUP_TABLE_SIZE(4)];
+  float *savedTable = _sensor._lookupTable;
+  uint8_t savedStrideShift = _sensor._lookupStrideShift;
+  float savedFractionScale = _sensor._lookupFractionScale;
+  _sensor.enableLookupTable(table, TZ_LOOKUP_TABLE_SIZE(4), 4);
+  beginRow(row);
+  for (uint16_t i = 0; i < iterations; i++) {
+    uint16_t index = i % _readingCount;
+    uint32_t start = cycles();
+    float temperature = _sensor.lookupTemperature(_readings[index]);
+    uint32_t end = cycles();
+    _sink = temperature;
+    addToRow(row, start, end, 1, temperature);
+  }
+  printRow(out, "lookupTemperature", 0, row);
+  _sensor._lookupTable = savedTable;
+  _sensor._lookupStrideShift = savedStrideShift;
+  _sensor._lookupFractionScale = savedFractionScale;
+
+  beginRow(row);
+  for (uint16_t i = 0; i < iterations; i++) {
+    uint16_t index = i % _readingCount;
+    uint32_t start = cycles();
+    int32_t milliC = _sensor.raw2milliC(_readings[index]);
+    uint32_t end = cycles();
+    addToRow(row, start, end, 1, milliC / 1000.0f);
+  }
+  printRow(out, "raw2milliC", 0, row);
+#endif
+}
+
+void TemperatureZeroBench::beginRow(Row &row) {
+  row.count = 0;
+  row.cyclesMin = 0xFFFFFFFF;
+  row.cyclesMax = 0;
+  row.cyclesSum = 0;
+  row.mean = 0;
+  row.squaredDeviations = 0;
+}
+
+// Add a measurement of calls calls, and its temperature for the noise statistics
+void TemperatureZeroBench::addToRow(Row &row, uint32_t start, uint32_t end, uint16_t calls, float temperature) {
+  uint32_t elapsed = end - start;
+  elapsed = (elapsed > _overhead ? elapsed - _overhead : 0) / calls;
+  row.cyclesMin = elapsed < row.cyclesMin ? elapsed : row.cyclesMin;
+  row.cyclesMax = elapsed > row.cyclesMax ? elapsed : row.cyclesMax;
+  row.cyclesSum += elapsed;
+  // Welford's running variance, numerically stable in single precision
+  row.count++;
+  float deviation = temperature - row.mean;
+  row.mean += deviation / row.count;
+  row.squaredDeviations += deviation * (temperature - row.mean);
+}
+
+void TemperatureZeroBench::printRow(Print &out, const char *path, uint16_t averaging, const Row &row) {
+  out.print(path);
+  out.print(",");
+  if (averaging != 0) {
+    out.print(averaging);
+  }
+  out.print(",");
+  out.print(row.count);
+  out.print(",");
+  out.print(row.cyclesMin);
+  out.print(",");
+  out.print((uint32_t)(row.cyclesSum / row.count));
+  out.print(",");
+  out.print(row.cyclesMax);
+  out.print(",");
+  out.print(row.mean, 3);
+  out.print(",");
+  out.println(row.count > 1 ? row.squaredDeviations / (row.count - 1) : 0.0f, 5);
+}
@@ -0,0 +1,51 @@
+/*
+  TemperatureZeroBench.h - Timing and noise characterization of the TemperatureZero library -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZEROBENCH_h
+#define TEMPERATUREZEROBENCH_h
+
+#include "Arduino.h"
+#include "TemperatureZero.h"
+
+// Number of readings kept for the conversion benchmarks
+#define TZ_BENCH_READINGS 32
+
+class TemperatureZeroBench
+{
+  public:
+    TemperatureZeroBench(TemperatureZero &sensor);
+    void run(Print &out, uint16_t iterations);
+    static void beginCycles();
+    static uint32_t cycles();
+
+  private:
+    struct Row {
+      uint32_t count;
+      uint32_t cyclesMin;
+      uint32_t cyclesMax;
+      uint64_t cyclesSum; // 2^32 cycles are only 90 s at 48 MHz
+      float mean;
+      float squaredDeviations;
+    };
+
+    TemperatureZero &_sensor;
+    uint32_t _overhead;
+    uint16_t _readingCount;
+#ifdef __SAMD51__
+    uint16_t _ptatReadings[TZ_BENCH_READINGS];
+    uint16_t _ctatReadings[TZ_BENCH_READINGS];
+#else
+    uint16_t _readings[TZ_BENCH_READINGS];
+#endif
+    float _temperatures[TZ_BENCH_READINGS];
+
+    void beginRow(Row &row);
+    void addToRow(Row &row, uint32_t start, uint32_t end, uint16_t calls, float temperature);
+    void printRow(Print &out, const char *path, uint16_t averaging, const Row &row);
+    void benchReads(Print &out, uint16_t iterations);
+    void benchConversions(Print &out, uint16_t iterations);
+};
+
+#endif
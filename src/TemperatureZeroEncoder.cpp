@@ -0,0 +1,177 @@
+/*
+  TemperatureZeroEncoder.cpp - Compact binary format for streaming TemperatureZero samples -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include "TemperatureZeroEncoder.h"
+
+#ifndef __SAMD51__
+
+static inline uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Encode count samples into destination, which should hold TZ_ENCODED_SIZE(count) bytes
+// Returns the number of bytes used, or 0 when capacity is smaller than TZ_ENCODED_SIZE(count).
+size_t TemperatureZeroEncoder::encode(const TemperatureZeroSample *samples, uint16_t count,
+                                      uint8_t *destination, size_t capacity) {
+  if (capacity < TZ_ENCODED_SIZE(count)) {
+    return 0;
+  }
+  size_t length = 0;
+  while (count > 0) {
+    uint16_t batch = batchLength(samples, count);
+    length += encodeBatch(samples, batch, destination + length);
+    samples += batch;
+    count -= batch;
+  }
+  return length;
+}
+
+#ifdef ARDUINO
+// Encode count samples and write them to out, e.g. a WiFiClient, TZ_ENCODER_BATCH_SAMPLES at a time
+// Returns the number of bytes written.
+size_t TemperatureZeroEncoder::encode(const TemperatureZeroSample *samples, uint16_t count, Print &out) {
+  uint8_t buffer[TZ_ENCODED_SIZE(TZ_ENCODER_BATCH_SAMPLES)];
+  size_t written = 0;
+  while (count > 0) {
+    uint16_t batch = count < TZ_ENCODER_BATCH_SAMPLES ? count : TZ_ENCODER_BATCH_SAMPLES;
+    written += out.write(buffer, encode(samples, batch, buffer, sizeof(buffer)));
+    samples += batch;
+    count -= batch;
+  }
+  return written;
+}
+
+// Encode the samples that are available in the ring buffer of sensor, see startContinuous() and
+// startScheduledSampling(), and write them to out. The samples are consumed, and timestamped by
+// readSamples(). Samples stored while writing are left for the next call.
+// Returns the number of bytes written.
+size_t TemperatureZeroEncoder::writeBuffer(TemperatureZero &sensor, Print &out) {
+  TemperatureZeroSample samples[TZ_ENCODER_BATCH_SAMPLES];
+  uint16_t remaining = sensor.getBufferAvailable();
+  size_t written = 0;
+  while (remaining > 0) {
+    uint16_t count = sensor.readSamples(samples, remaining < TZ_ENCODER_BATCH_SAMPLES ? remaining : TZ_ENCODER_BATCH_SAMPLES);
+    if (count == 0) {
+      break;
+    }
+    written += encode(samples, count, out);
+    remaining -= count;
+  }
+  return written;
+}
+#endif
+
+// Decode the batch at the start of data into samples, setting count to the number of samples in it
+// Returns the number of bytes of the batch, or 0 when data does not start with a complete batch of
+// at most capacity samples. On a stream, wait for more data in that case, or skip a byte to find the
+// next TZ_ENCODER_SYNC when length exceeds TZ_ENCODED_SIZE(capacity).
+size_t TemperatureZeroEncoder::decode(const uint8_t *data, size_t length, TemperatureZeroSample *samples,
+                                      uint16_t capacity, uint16_t &count) {
+  const uint8_t *end = data + length;
+  const uint8_t *position = data;
+  count = 0;
+  if (length == 0 || *position++ != TZ_ENCODER_SYNC) {
+    return 0;
+  }
+  uint32_t batch;
+  position = readVarint(position, end, batch);
+  if (position == NULL || batch == 0 || batch > capacity || end - position < 8) {
+    return 0;
+  }
+  uint8_t averaging = *position++;
+  uint8_t flags = *position++;
+  uint32_t timestamp = (uint32_t)position[0] | ((uint32_t)position[1] << 8) |
+                       ((uint32_t)position[2] << 16) | ((uint32_t)position[3] << 24);
+  uint16_t raw = position[4] | (position[5] << 8);
+  position += 6;
+  uint32_t step = 0;
+  for (uint16_t i = 0; i < batch; i++) {
+    if (i > 0) {
+      uint32_t stepChange;
+      uint32_t rawChange;
+      position = readVarint(position, end, stepChange);
+      if (position != NULL) {
+        position = readVarint(position, end, rawChange);
+      }
+      if (position == NULL) {
+        return 0;
+      }
+      step += (uint32_t)unzigzag(stepChange);
+      timestamp += step;
+      raw += (uint16_t)unzigzag(rawChange);
+    }
+    samples[i].timestamp = timestamp;
+    samples[i].raw = raw;
+    samples[i].averaging = averaging;
+    samples[i].flags = flags;
+  }
+  count = batch;
+  return position - data;
+}
+
+// Number of samples from the first one on that share its averaging and flags
+uint16_t TemperatureZeroEncoder::batchLength(const TemperatureZeroSample *samples, uint16_t count) {
+  uint16_t length = 1;
+  while (length < count && samples[length].averaging == samples[0].averaging &&
+         samples[length].flags == samples[0].flags) {
+    length++;
+  }
+  return length;
+}
+
+size_t TemperatureZeroEncoder::encodeBatch(const TemperatureZeroSample *samples, uint16_t count, uint8_t *destination) {
+  uint8_t *position = destination;
+  *position++ = TZ_ENCODER_SYNC;
+  position = writeVarint(position, count);
+  *position++ = samples[0].averaging;
+  *position++ = samples[0].flags;
+  uint32_t timestamp = samples[0].timestamp;
+  *position++ = timestamp;
+  *position++ = timestamp >> 8;
+  *position++ = timestamp >> 16;
+  *position++ = timestamp >> 24;
+  *position++ = samples[0].raw;
+  *position++ = samples[0].raw >> 8;
+  // Regularly spaced samples keep the time step, so only its change is stored
+  uint32_t step = 0;
+  for (uint16_t i = 1; i < count; i++) {
+    uint32_t nextStep = samples[i].timestamp - samples[i - 1].timestamp;
+    position = writeVarint(position, zigzag((int32_t)(nextStep - step)));
+    position = writeVarint(position, zigzag((int32_t)samples[i].raw - (int32_t)samples[i - 1].raw));
+    step = nextStep;
+  }
+  return position - destination;
+}
+
+uint8_t *TemperatureZeroEncoder::writeVarint(uint8_t *destination, uint32_t value) {
+  while (value >= 0x80) {
+    *destination++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *destination++ = value;
+  return destination;
+}
+
+// Returns NULL when data ends within the varint, or it is longer than 32 bits
+const uint8_t *TemperatureZeroEncoder::readVarint(const uint8_t *data, const uint8_t *end, uint32_t &value) {
+  value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (data == end) {
+      return NULL;
+    }
+    uint8_t byte = *data++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return data;
+    }
+  }
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+  TemperatureZeroEncoder.h - Compact binary format for streaming TemperatureZero samples -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZEROENCODER_h
+#define TEMPERATUREZEROENCODER_h
+
+// The packing itself only needs the C library, so it is tested on a host compiler as well, without
+// the Print and TemperatureZero parts, see extras/test.
+#ifdef ARDUINO
+#include "Arduino.h"
+#include "TemperatureZero.h"
+#else
+#include <stddef.h>
+#include "TemperatureZeroSample.h"
+#endif
+
+#ifndef __SAMD51__
+
+// First byte of every batch
+#define TZ_ENCODER_SYNC 0xA5
+
+// Worst case number of bytes encode() needs for count samples
+#define TZ_ENCODED_SIZE(count) (10 * (size_t)(count))
+
+// Number of samples encoded at a time when writing to a Print, on the stack
+#ifndef TZ_ENCODER_BATCH_SAMPLES
+#define TZ_ENCODER_BATCH_SAMPLES 32
+#endif
+
+// Packs TemperatureZeroSample records into batches of delta encoded varints
+// A batch holds samples of the same averaging and flags, a new one starts whenever they change:
+//   sync     TZ_ENCODER_SYNC
+//   count    number of samples, varint
+//   setup    averaging and flags of all samples, one byte each
+//   first    timestamp (4 bytes) and raw reading (2 bytes) of the first sample, little endian
+//   others   per sample the change of the time step since the previous sample, then the change of
+//            the raw reading, both as zigzag varint
+// Varints hold 7 bits per byte, least significant first, with the top bit set on all but the last byte.
+// Zigzag maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ... so small changes of either sign take one byte.
+// Regularly spaced samples of a steady temperature take 2 bytes each, against about 16 for a
+// timestamp and a temperature printed as text. Every batch can be decoded on its own.
+class TemperatureZeroEncoder
+{
+  public:
+    static size_t encode(const TemperatureZeroSample *samples, uint16_t count, uint8_t *destination, size_t capacity);
+#ifdef ARDUINO
+    static size_t encode(const TemperatureZeroSample *samples, uint16_t count, Print &out);
+    static size_t writeBuffer(TemperatureZero &sensor, Print &out);
+#endif
+    static size_t decode(const uint8_t *data, size_t length, TemperatureZeroSample *samples, uint16_t capacity,
+                         uint16_t &count);
+
+  private:
+    static uint16_t batchLength(const TemperatureZeroSample *samples, uint16_t count);
+    static size_t encodeBatch(const TemperatureZeroSample *samples, uint16_t count, uint8_t *destination);
+    static uint8_t *writeVarint(uint8_t *destination, uint32_t value);
+    static const uint8_t *readVarint(const uint8_t *data, const uint8_t *end, uint32_t &value);
+};
+
+#endif
+#endif
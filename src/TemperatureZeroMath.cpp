@@ -0,0 +1,318 @@
+/*
+  TemperatureZeroMath.cpp - Hardware independent conversion math of the TemperatureZero library -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#include "TemperatureZeroMath.h"
+
+#define INT1V_DIVIDER_1000                1000.0
+#define ADC_12BIT_FULL_SCALE_VALUE_FLOAT  4095.0
+
+// (numerator << shift) / divisor, without overflowing on the shifted numerator
+static int64_t divideScaled(int64_t numerator, int64_t divisor, uint8_t shift) {
+  int64_t quotient = numerator / divisor;
+  int64_t remainder = numerator % divisor;
+  return quotient * ((int64_t)1 << shift) + (remainder * ((int64_t)1 << shift)) / divisor;
+}
+
+// Extra safe decimal to fractional conversion
+float TemperatureZeroMath::convertDecToFrac(uint8_t val) {
+  if (val < 10) {
+    return ((float)val/10.0);
+  } else if (val <100) {
+    return ((float)val/100.0);
+  } else {
+    return ((float)val/1000.0);
+  }
+}
+
+// Extra safe decimal to milli conversion, the integer counterpart of convertDecToFrac()
+int32_t TemperatureZeroMath::convertDecToMilli(uint8_t val) {
+  if (val < 10) {
+    return (int32_t)val * 100;
+  } else if (val <100) {
+    return (int32_t)val * 10;
+  } else {
+    return val;
+  }
+}
+
+// Round to Q16 fixed point
+int32_t TemperatureZeroMath::toQ16(float value) {
+  return (int32_t)(value * 65536.0f + (value < 0 ? -0.5f : 0.5f));
+}
+
+// Round to thousandths
+int32_t TemperatureZeroMath::toMilli(float value) {
+  return (int32_t)(value * 1000.0f + (value < 0 ? -0.5f : 0.5f));
+}
+
+// Gain and offset correction from two point linear interpolation for hot and cold measurements
+void TemperatureZeroMath::solveUserCalibration2P(float coldGroundTruth, float coldMeasurement,
+                                                 float hotGroundTruth, float hotMeasurement,
+                                                 float &gainCorrection, float &offsetCorrection) {
+  offsetCorrection = coldMeasurement - coldGroundTruth * (hotMeasurement - coldMeasurement) / (hotGroundTruth - coldGroundTruth);
+  gainCorrection = hotGroundTruth / (hotMeasurement - offsetCorrection);
+}
+
+// Derive slope and intercept of every segment once, in float and for the integer path, so a
+// conversion only searches its segment and does one multiply-add
+// The last point has no segment of its own, it keeps the one ending there. The ground truths are
+// not kept, see calibrationGroundTruth().
+void TemperatureZeroMath::compileCalibrationPoints(TemperatureZeroCalibrationPoint *points, const float *measurements,
+                                                   const float *groundTruths, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    TemperatureZeroCalibrationPoint &point = points[i];
+    uint8_t segment = i + 1 < count ? i : i - 1;
+    point.measurement = measurements[i];
+    point.slope = (groundTruths[segment + 1] - groundTruths[segment]) / (measurements[segment + 1] - measurements[segment]);
+    point.intercept = groundTruths[segment] - point.slope * measurements[segment];
+    point.measurementMilliC = toMilli(point.measurement);
+    point.slopeQ16 = toQ16(point.slope);
+    point.interceptMilliC = toMilli(point.intercept);
+  }
+}
+
+// Ground truth of point i, from the segment stored with it
+float TemperatureZeroMath::calibrationGroundTruth(const TemperatureZeroCalibrationPoint *points, uint8_t i) {
+  return points[i].intercept + points[i].slope * points[i].measurement;
+}
+
+// Binary search for the segment of value, at most log2(count) steps, shared by the float and the
+// integer path through the measurement field they compare against
+template <typename T>
+static uint8_t findSegment(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                           T TemperatureZeroCalibrationPoint::*measurement, T value) {
+  uint8_t low = 0;
+  uint8_t high = count - 2;
+  while (low < high) {
+    uint8_t middle = (low + high + 1) / 2;
+    if (value >= points[middle].*measurement) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
+}
+
+uint8_t TemperatureZeroMath::findCalibrationSegment(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                                                    float temperature) {
+  return findSegment(points, count, &TemperatureZeroCalibrationPoint::measurement, temperature);
+}
+
+// Correct temperature piecewise linearly, for count >= 2 points
+float TemperatureZeroMath::applyCalibrationPoints(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                                                  float temperature) {
+  const TemperatureZeroCalibrationPoint &point = points[findCalibrationSegment(points, count, temperature)];
+  return point.intercept + point.slope * temperature;
+}
+
+// Integer counterpart of applyCalibrationPoints(), in milli degrees
+int32_t TemperatureZeroMath::applyCalibrationPointsMilliC(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                                                          int32_t milliC) {
+  const TemperatureZeroCalibrationPoint &point =
+    points[findSegment(points, count, &TemperatureZeroCalibrationPoint::measurementMilliC, milliC)];
+  return point.interceptMilliC + (int32_t)(((int64_t)point.slopeQ16 * milliC + 0x8000) >> 16);
+}
+
+// Combine the SAMD21 temperature log into temperatures and the temperature dependent 1V reference
+TemperatureZeroSamd21Calibration TemperatureZeroMath::calibration(const TemperatureZeroSamd21Fuses &fuses) {
+  TemperatureZeroSamd21Calibration calibration;
+  calibration.roomTemperature = fuses.roomInteger + convertDecToFrac(fuses.roomDecimal);
+  calibration.hotTemperature = fuses.hotInteger + convertDecToFrac(fuses.hotDecimal);
+  calibration.roomReading = fuses.roomReading;
+  calibration.hotReading = fuses.hotReading;
+  calibration.roomInt1vRef = 1 - ((float)fuses.roomInt1vRef/INT1V_DIVIDER_1000);
+  calibration.hotInt1vRef = 1 - ((float)fuses.hotInt1vRef/INT1V_DIVIDER_1000);
+  // Combining the temperature dependent 1v reference with the ADC readings
+  calibration.roomVoltageCompensated = ((float)fuses.roomReading * calibration.roomInt1vRef)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+  calibration.hotVoltageCompensated = ((float)fuses.hotReading * calibration.hotInt1vRef)/ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+  return calibration;
+}
+
+// Coefficients of the SAMD21 factory calibration
+// With v = adcReading / 4095, S the temperature/voltage slope and K the 1V reference/temperature slope,
+// the two stage interpolation of the datasheet expands to a quadratic in the reading:
+//   coarse  = Troom + S * (v - Vroom)
+//   ref1V   = Rroom + K * (coarse - Troom) = Rroom + K * S * (v - Vroom)
+//   refined = Troom + S * (v * ref1V - Vroom)
+//           = (Troom - S * Vroom) + S * (Rroom - K * S * Vroom) * v + S * K * S * v^2
+TemperatureZeroQuadratic TemperatureZeroMath::quadratic(const TemperatureZeroSamd21Calibration &calibration) {
+  TemperatureZeroQuadratic coefficients;
+  float scale = 1.0 / ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+  float temperatureSlope = (calibration.hotTemperature - calibration.roomTemperature)/(calibration.hotVoltageCompensated - calibration.roomVoltageCompensated);
+  float int1vRefSlope = (calibration.hotInt1vRef - calibration.roomInt1vRef)/(calibration.hotTemperature - calibration.roomTemperature);
+  coefficients.offset = calibration.roomTemperature - temperatureSlope * calibration.roomVoltageCompensated;
+  coefficients.linear = temperatureSlope * (calibration.roomInt1vRef - int1vRefSlope * temperatureSlope * calibration.roomVoltageCompensated) * scale;
+  coefficients.quadratic = temperatureSlope * int1vRefSlope * temperatureSlope * scale * scale;
+  return coefficients;
+}
+
+// Coefficients for a measured 1V reference, from a bandgap reading at half gain:
+//   ref1V   = bandgapVoltage * 4095 / (2 * bandgapReading)
+//   refined = Troom + S * (adcReading * ref1V / 4095 - Vroom)
+//           = (Troom - S * Vroom) + S * bandgapVoltage / 2 * adcReading / bandgapReading
+TemperatureZeroLinear TemperatureZeroMath::compensated(const TemperatureZeroSamd21Calibration &calibration, float bandgapVoltage) {
+  TemperatureZeroLinear coefficients;
+  float temperatureSlope = (calibration.hotTemperature - calibration.roomTemperature)/(calibration.hotVoltageCompensated - calibration.roomVoltageCompensated);
+  coefficients.offset = calibration.roomTemperature - temperatureSlope * calibration.roomVoltageCompensated;
+  coefficients.linear = temperatureSlope * bandgapVoltage * 0.5f;
+  return coefficients;
+}
+
+// Bandgap voltage for which compensated() gives the factory conversion of quadratic() on these readings
+// The 1V reference is estimated from the coarse temperature, like in the datasheet, and the bandgap
+// reading at half gain then tells the bandgap voltage:
+//   coarse         = Troom + S * (adcReading / 4095 - Vroom)
+//   ref1V          = Rroom + K * (coarse - Troom)
+//   bandgapVoltage = ref1V * 2 * bandgapReading / 4095
+float TemperatureZeroMath::bandgapVoltage(const TemperatureZeroSamd21Calibration &calibration, uint16_t adcReading,
+                                          uint16_t bandgapReading) {
+  float temperatureSlope = (calibration.hotTemperature - calibration.roomTemperature)/(calibration.hotVoltageCompensated - calibration.roomVoltageCompensated);
+  float int1vRefSlope = (calibration.hotInt1vRef - calibration.roomInt1vRef)/(calibration.hotTemperature - calibration.roomTemperature);
+  float coarseTemperature = calibration.roomTemperature + temperatureSlope * ((float)adcReading / ADC_12BIT_FULL_SCALE_VALUE_FLOAT - calibration.roomVoltageCompensated);
+  float ref1V = calibration.roomInt1vRef + int1vRefSlope * (coarseTemperature - calibration.roomTemperature);
+  return ref1V * 2.0f * (float)bandgapReading / ADC_12BIT_FULL_SCALE_VALUE_FLOAT;
+}
+
+// Integer coefficients, derived directly from the fuses
+// These are the coefficients of quadratic(), in fixed point and with every voltage
+// kept as adc reading times 1V reference in mV, so no float math is needed:
+//   offset    = Troom - dT * Vroom / dV                         [milli degrees]
+//   linear    = dT * (Rroom * dV - dR * Vroom) / dV^2           [milli degrees / adc step, Q16]
+//   quadratic = 1000 * dT * dR / dV^2                           [milli degrees / adc step^2, Q32]
+TemperatureZeroFixedQuadratic TemperatureZeroMath::fixedQuadratic(const TemperatureZeroSamd21Fuses &fuses) {
+  TemperatureZeroFixedQuadratic coefficients;
+  int64_t roomTemperature = (int32_t)fuses.roomInteger * 1000 + convertDecToMilli(fuses.roomDecimal);
+  int64_t hotTemperature = (int32_t)fuses.hotInteger * 1000 + convertDecToMilli(fuses.hotDecimal);
+  int64_t roomInt1vRef = 1000 - fuses.roomInt1vRef;
+  int64_t hotInt1vRef = 1000 - fuses.hotInt1vRef;
+
+  int64_t roomVoltage = (int64_t)fuses.roomReading * roomInt1vRef;
+  int64_t deltaVoltage = (int64_t)fuses.hotReading * hotInt1vRef - roomVoltage;
+  int64_t deltaTemperature = hotTemperature - roomTemperature;
+  int64_t deltaInt1vRef = hotInt1vRef - roomInt1vRef;
+  if (deltaVoltage == 0) {
+    // Unprogrammed fuses, nothing sensible to derive
+    coefficients.offset = 0;
+    coefficients.linear = 0;
+    coefficients.quadratic = 0;
+  } else {
+    coefficients.offset = (int32_t)(roomTemperature - (deltaTemperature * roomVoltage + deltaVoltage / 2) / deltaVoltage);
+    coefficients.linear = (int32_t)(divideScaled(deltaTemperature * (roomInt1vRef * deltaVoltage - deltaInt1vRef * roomVoltage), deltaVoltage, 16) / deltaVoltage);
+    coefficients.quadratic = (int32_t)divideScaled(divideScaled(1000 * deltaTemperature * deltaInt1vRef, deltaVoltage, 16), deltaVoltage, 16);
+  }
+  return coefficients;
+}
+
+// The user calibration (T - offset) * gain only scales and shifts the coefficients
+void TemperatureZeroMath::applyUserCalibration(TemperatureZeroQuadratic &coefficients, float gainCorrection, float offsetCorrection) {
+  coefficients.offset = (coefficients.offset - offsetCorrection) * gainCorrection;
+  coefficients.linear *= gainCorrection;
+  coefficients.quadratic *= gainCorrection;
+}
+
+void TemperatureZeroMath::applyUserCalibration(TemperatureZeroLinear &coefficients, float gainCorrection, float offsetCorrection) {
+  coefficients.offset = (coefficients.offset - offsetCorrection) * gainCorrection;
+  coefficients.linear *= gainCorrection;
+}
+
+void TemperatureZeroMath::applyUserCalibration(TemperatureZeroFixedQuadratic &coefficients, int32_t gainCorrectionQ16,
+                                               int32_t offsetCorrectionMilliC) {
+  coefficients.offset = (int32_t)(((int64_t)(coefficients.offset - offsetCorrectionMilliC) * gainCorrectionQ16) >> 16);
+  coefficients.linear = (int32_t)(((int64_t)coefficients.linear * gainCorrectionQ16) >> 16);
+  coefficients.quadratic = (int32_t)(((int64_t)coefficients.quadratic * gainCorrectionQ16) >> 16);
+}
+
+// Convert an array of raw 12 bit adc readings, with the same results as raw2temp() per reading
+void TemperatureZeroMath::raw2temp(const TemperatureZeroQuadratic &coefficients, const uint16_t *adcReadings,
+                                   float *temperatures, size_t count) {
+  // Local copies, so the compiler does not reload them after every store into temperatures
+  const float offset = coefficients.offset;
+  const float linear = coefficients.linear;
+  const float quadratic = coefficients.quadratic;
+
+  for (size_t i = 0; i < count; i++) {
+    float adcReading = (float)adcReadings[i];
+    temperatures[i] = offset + adcReading * (linear + adcReading * quadratic);
+  }
+}
+
+// Find the lowest raw reading that converts to more than celsius, 4096 when there is none
+// The conversion, with pointCount calibration points when not 0, rises with the reading, so a
+// binary search over the 12 bit range suffices.
+uint16_t TemperatureZeroMath::temp2raw(const TemperatureZeroQuadratic &coefficients,
+                                       const TemperatureZeroCalibrationPoint *points, uint8_t pointCount,
+                                       float celsius) {
+  uint16_t low = 0;
+  uint16_t high = 4096;
+  while (low < high) {
+    uint16_t middle = (low + high) / 2;
+    float temperature = raw2temp(coefficients, (float)middle);
+    if (pointCount != 0) {
+      temperature = applyCalibrationPoints(points, pointCount, temperature);
+    }
+    if (temperature > celsius) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+// Fill size entries, one every (1 << strideShift) adc steps
+void TemperatureZeroMath::buildLookupTable(const TemperatureZeroQuadratic &coefficients, float *table, uint16_t size,
+                                           uint8_t strideShift) {
+  for (uint16_t i = 0; i < size; i++) {
+    table[i] = raw2temp(coefficients, (float)((uint32_t)i << strideShift));
+  }
+}
+
+// Combine the SAMD51 temperature log into temperatures and readings
+TemperatureZeroSamd51Calibration TemperatureZeroMath::calibration(const TemperatureZeroSamd51Fuses &fuses) {
+  TemperatureZeroSamd51Calibration calibration;
+  calibration.roomTemperature = fuses.roomInteger + convertDecToFrac(fuses.roomDecimal);
+  calibration.hotTemperature = fuses.hotInteger + convertDecToFrac(fuses.hotDecimal);
+  calibration.roomPtat = fuses.roomPtat;
+  calibration.hotPtat = fuses.hotPtat;
+  calibration.roomCtat = fuses.roomCtat;
+  calibration.hotCtat = fuses.hotCtat;
+  return calibration;
+}
+
+// Coefficients of the SAMD51 factory calibration
+// From SAMD51 datasheet: section 45.6.3.1 (page 1327):
+//   T = (TL*VPH*TC - VPL*TH*TC - TL*VCH*TP + TH*VCL*TP) / (VCL*TP - VCH*TP - VPL*TC + VPH*TC)
+// Grouping by reading gives T = (a * TC + b * TP) / (c * TP + d * TC).
+TemperatureZeroRational TemperatureZeroMath::rational(const TemperatureZeroSamd51Calibration &calibration) {
+  TemperatureZeroRational coefficients;
+  coefficients.numeratorCtat = calibration.roomTemperature * calibration.hotPtat - calibration.roomPtat * calibration.hotTemperature;
+  coefficients.numeratorPtat = calibration.hotTemperature * calibration.roomCtat - calibration.roomTemperature * calibration.hotCtat;
+  coefficients.denominatorPtat = (float)calibration.roomCtat - (float)calibration.hotCtat;
+  coefficients.denominatorCtat = (float)calibration.hotPtat - (float)calibration.roomPtat;
+  return coefficients;
+}
+
+// The user calibration gain * (T - offset) becomes gain * ((a - offset * d) * TC + (b - offset * c) * TP) / (...)
+void TemperatureZeroMath::applyUserCalibration(TemperatureZeroRational &coefficients, float gainCorrection, float offsetCorrection) {
+  coefficients.numeratorCtat = (coefficients.numeratorCtat - offsetCorrection * coefficients.denominatorCtat) * gainCorrection;
+  coefficients.numeratorPtat = (coefficients.numeratorPtat - offsetCorrection * coefficients.denominatorPtat) * gainCorrection;
+}
+
+// Convert arrays of PTAT and CTAT readings
+void TemperatureZeroMath::raw2temp(const TemperatureZeroRational &coefficients, const uint16_t *TP, const uint16_t *TC,
+                                   float *temperatures, size_t count) {
+  // Local copies, so the compiler does not reload them after every store into temperatures
+  const float numeratorCtat = coefficients.numeratorCtat;
+  const float numeratorPtat = coefficients.numeratorPtat;
+  const float denominatorPtat = coefficients.denominatorPtat;
+  const float denominatorCtat = coefficients.denominatorCtat;
+
+  for (size_t i = 0; i < count; i++) {
+    float ptat = (float)TP[i];
+    float ctat = (float)TC[i];
+    temperatures[i] = (numeratorCtat * ctat + numeratorPtat * ptat) / (denominatorPtat * ptat + denominatorCtat * ctat);
+  }
+}
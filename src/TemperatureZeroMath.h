@@ -0,0 +1,188 @@
+/*
+  TemperatureZeroMath.h - Hardware independent conversion math of the TemperatureZero library -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZEROMATH_h
+#define TEMPERATUREZEROMATH_h
+
+// Only the C library, no Arduino.h or register definitions, so this builds on a host compiler as well.
+// The fuse values are passed in, TemperatureZero reads them from the NVM software calibration area.
+#include <stddef.h>
+#include <stdint.h>
+
+// Factory calibration fields of the SAMD21 temperature log, as stored in the fuses
+struct TemperatureZeroSamd21Fuses {
+  uint8_t roomInteger;
+  uint8_t roomDecimal;
+  uint8_t hotInteger;
+  uint8_t hotDecimal;
+  uint16_t roomReading;
+  uint16_t hotReading;
+  int8_t roomInt1vRef;      // deviation of the 1V reference from 1V, in mV
+  int8_t hotInt1vRef;
+};
+
+// SAMD21 factory calibration in degrees and volts
+struct TemperatureZeroSamd21Calibration {
+  float roomTemperature;
+  float hotTemperature;
+  uint16_t roomReading;
+  uint16_t hotReading;
+  float roomInt1vRef;
+  float hotInt1vRef;
+  float roomVoltageCompensated;
+  float hotVoltageCompensated;
+};
+
+// Factory calibration fields of the SAMD51 temperature log
+struct TemperatureZeroSamd51Fuses {
+  uint8_t roomInteger;
+  uint8_t roomDecimal;
+  uint8_t hotInteger;
+  uint8_t hotDecimal;
+  uint16_t roomPtat;
+  uint16_t hotPtat;
+  uint16_t roomCtat;
+  uint16_t hotCtat;
+};
+
+// SAMD51 factory calibration, TL/TH and VPL/VPH/VCL/VCH in the datasheet
+struct TemperatureZeroSamd51Calibration {
+  float roomTemperature;
+  float hotTemperature;
+  uint16_t roomPtat;
+  uint16_t hotPtat;
+  uint16_t roomCtat;
+  uint16_t hotCtat;
+};
+
+// T = offset + r * (linear + r * quadratic), for a 12 bit reading r
+struct TemperatureZeroQuadratic {
+  float offset;
+  float linear;
+  float quadratic;
+};
+
+// Integer counterpart, in milli degrees. Linear is Q16 and quadratic Q32 per adc step
+struct TemperatureZeroFixedQuadratic {
+  int32_t offset;
+  int32_t linear;
+  int32_t quadratic;
+};
+
+// T = offset + linear * x, e.g. with x the ratio of the temperature and bandgap readings
+struct TemperatureZeroLinear {
+  float offset;
+  float linear;
+};
+
+// Point of a piecewise linear user calibration, with the segment from it to the next point, as
+// T = intercept + slope * measured. The integer fields are the same in milli degrees, slope in Q16,
+// only used on the SAMD21.
+struct TemperatureZeroCalibrationPoint {
+  float measurement;
+  float slope;
+  float intercept;
+  int32_t measurementMilliC;
+  int32_t slopeQ16;
+  int32_t interceptMilliC;
+};
+
+// T = (numeratorCtat * TC + numeratorPtat * TP) / (denominatorPtat * TP + denominatorCtat * TC)
+struct TemperatureZeroRational {
+  float numeratorCtat;
+  float numeratorPtat;
+  float denominatorPtat;
+  float denominatorCtat;
+};
+
+class TemperatureZeroMath
+{
+  public:
+    static float convertDecToFrac(uint8_t val);
+    static int32_t convertDecToMilli(uint8_t val);
+    static int32_t toQ16(float value);
+    static int32_t toMilli(float value);
+    static void solveUserCalibration2P(float coldGroundTruth, float coldMeasurement,
+                                       float hotGroundTruth, float hotMeasurement,
+                                       float &gainCorrection, float &offsetCorrection);
+    static void compileCalibrationPoints(TemperatureZeroCalibrationPoint *points, const float *measurements,
+                                         const float *groundTruths, uint8_t count);
+    static float calibrationGroundTruth(const TemperatureZeroCalibrationPoint *points, uint8_t i);
+    static uint8_t findCalibrationSegment(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                                          float temperature);
+    static float applyCalibrationPoints(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                                        float temperature);
+    static int32_t applyCalibrationPointsMilliC(const TemperatureZeroCalibrationPoint *points, uint8_t count,
+                                                int32_t milliC);
+
+    static TemperatureZeroSamd21Calibration calibration(const TemperatureZeroSamd21Fuses &fuses);
+    static TemperatureZeroQuadratic quadratic(const TemperatureZeroSamd21Calibration &calibration);
+    static TemperatureZeroLinear compensated(const TemperatureZeroSamd21Calibration &calibration, float bandgapVoltage);
+    static float bandgapVoltage(const TemperatureZeroSamd21Calibration &calibration, uint16_t adcReading,
+                                uint16_t bandgapReading);
+    static TemperatureZeroFixedQuadratic fixedQuadratic(const TemperatureZeroSamd21Fuses &fuses);
+    static void applyUserCalibration(TemperatureZeroQuadratic &coefficients, float gainCorrection, float offsetCorrection);
+    static void applyUserCalibration(TemperatureZeroLinear &coefficients, float gainCorrection, float offsetCorrection);
+    static void applyUserCalibration(TemperatureZeroFixedQuadratic &coefficients, int32_t gainCorrectionQ16,
+                                     int32_t offsetCorrectionMilliC);
+    static void raw2temp(const TemperatureZeroQuadratic &coefficients, const uint16_t *adcReadings,
+                         float *temperatures, size_t count);
+    static void buildLookupTable(const TemperatureZeroQuadratic &coefficients, float *table, uint16_t size,
+                                 uint8_t strideShift);
+    static uint16_t temp2raw(const TemperatureZeroQuadratic &coefficients, const TemperatureZeroCalibrationPoint *points,
+                             uint8_t pointCount, float celsius);
+
+    static TemperatureZeroSamd51Calibration calibration(const TemperatureZeroSamd51Fuses &fuses);
+    static TemperatureZeroRational rational(const TemperatureZeroSamd51Calibration &calibration);
+    static void applyUserCalibration(TemperatureZeroRational &coefficients, float gainCorrection, float offsetCorrection);
+    static void raw2temp(const TemperatureZeroRational &coefficients, const uint16_t *TP, const uint16_t *TC,
+                         float *temperatures, size_t count);
+
+    static inline float raw2temp(const TemperatureZeroQuadratic &coefficients, float adcReading) {
+      return coefficients.offset + adcReading * (coefficients.linear + adcReading * coefficients.quadratic);
+    }
+
+    // Reading with extraBits beyond 12 bits, keeping the fraction below one 12 bit adc step
+    static inline float raw2temp(const TemperatureZeroQuadratic &coefficients, uint32_t oversampledReading,
+                                 uint8_t extraBits) {
+      return raw2temp(coefficients, (float)oversampledReading / (float)(1UL << extraBits));
+    }
+
+    // Decimate the sum of 4^extraBits 12 bit readings to a reading with extraBits beyond 12 bits
+    static inline uint32_t decimate(uint32_t sum, uint8_t extraBits) {
+      return sum >> extraBits;
+    }
+
+    // Rounded to 1 milli degree
+    static inline int32_t raw2milliC(const TemperatureZeroFixedQuadratic &coefficients, uint16_t adcReading) {
+      int32_t linear = coefficients.linear + (int32_t)(((int64_t)coefficients.quadratic * adcReading) >> 16);
+      return coefficients.offset + (int32_t)(((int64_t)linear * adcReading + 0x8000) >> 16);
+    }
+
+    static inline float raw2temp(const TemperatureZeroLinear &coefficients, float ratio) {
+      return coefficients.offset + coefficients.linear * ratio;
+    }
+
+    static inline float raw2temp(const TemperatureZeroRational &coefficients, uint16_t TP, uint16_t TC) {
+      return (coefficients.numeratorCtat * TC + coefficients.numeratorPtat * TP) /
+             (coefficients.denominatorPtat * TP + coefficients.denominatorCtat * TC);
+    }
+
+    // Table of buildLookupTable(), with fractionScale = 1 / (1 << strideShift)
+    static inline float lookupTemperature(const float *table, uint8_t strideShift, float fractionScale,
+                                          uint16_t adcReading) {
+      if (adcReading > 4095) {
+        adcReading = 4095;
+      }
+      if (strideShift == 0) {
+        return table[adcReading];
+      }
+      uint16_t index = adcReading >> strideShift;
+      float fraction = (float)(adcReading & ((1 << strideShift) - 1)) * fractionScale;
+      return table[index] + (table[index + 1] - table[index]) * fraction;
+    }
+};
+
+#endif
@@ -0,0 +1,26 @@
+/*
+  TemperatureZeroSample.h - Timestamped raw reading of the TemperatureZero library -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZEROSAMPLE_h
+#define TEMPERATUREZEROSAMPLE_h
+
+// Only the C library, like TemperatureZeroMath.h, so TemperatureZeroEncoder builds on a host compiler as well.
+#include <stdint.h>
+
+// Flags of a TemperatureZeroSample
+#define TZ_SAMPLE_USER_CALIBRATED 0x01 // the user calibration was enabled
+#define TZ_SAMPLE_BUFFERED        0x02 // from the ring buffer of startContinuous() or startScheduledSampling()
+#define TZ_SAMPLE_OVERRUN         0x04 // samples were overwritten in the ring buffer right before this one
+
+// Raw reading with the time and the setup it was taken with, filled by readSample() and readSamples()
+// It is what TemperatureZeroEncoder packs for telemetry, the conversion is left to the receiver.
+struct TemperatureZeroSample {
+  uint32_t timestamp;  // micros() at the end of the conversion, interpolated for buffered samples
+  uint16_t raw;        // 12 bit adc reading
+  uint8_t averaging;   // TZ_AVERAGING_ mode of the reading
+  uint8_t flags;       // TZ_SAMPLE_ flags
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+  TemperatureZeroT.h - TemperatureZero with the user calibration and averaging fixed at compile time -
+  Copyright (c) 2018 Electronic Cats.  All right reserved.
+*/
+
+#ifndef TEMPERATUREZEROT_h
+#define TEMPERATUREZEROT_h
+
+#include "Arduino.h"
+#include "TemperatureZero.h"
+
+#ifndef __SAMD51__
+
+// Default configuration for TemperatureZeroT, derive from it to override single values, e.g.
+//   struct BoardCalibration : TemperatureZeroDefaultConfig {
+//     static constexpr float gainCorrection = 1.0125f;
+//     static constexpr float offsetCorrection = -0.83f;
+//     static constexpr uint8_t averaging = TZ_AVERAGING_16;
+//   };
+//   TemperatureZeroT<BoardCalibration> TempZero;
+// The corrections are those of setUserCalibration(), the defaults leave the factory calibration as is.
+struct TemperatureZeroDefaultConfig {
+  static constexpr float gainCorrection = 1.0f;
+  static constexpr float offsetCorrection = 0.0f;
+  static constexpr uint8_t averaging = TZ_AVERAGING_64;
+};
+
+// Reduced TemperatureZero for a calibration that is known when building
+// The user calibration is folded into the coefficients by init(), and the AVGCTRL value is a
+// constant, so a read has neither the user calibration branch nor the averaging switch, and the
+// object only holds the three conversion coefficients. The ADC is shared through TemperatureZeroAdc,
+// like TemperatureZero does outside of a session.
+template <class Config = TemperatureZeroDefaultConfig>
+class TemperatureZeroT
+{
+  static_assert(Config::averaging <= TZ_AVERAGING_256, "TemperatureZeroT needs a TZ_AVERAGING_ value");
+
+  public:
+    // AVGCTRL value for Config::averaging, the counterpart of TemperatureZero::averagingControl()
+    static constexpr uint8_t averagingControl = Config::averaging == TZ_AVERAGING_1 ? 0 :
+      ADC_AVGCTRL_SAMPLENUM(Config::averaging) | ADC_AVGCTRL_ADJRES(Config::averaging < 4 ? Config::averaging : 4);
+
+    void init() {
+      _conversion = TemperatureZeroMath::quadratic(TemperatureZeroMath::calibration(TemperatureZero::readFuses()));
+      TemperatureZeroMath::applyUserCalibration(_conversion, Config::gainCorrection, Config::offsetCorrection);
+      wakeup();
+    }
+
+    void wakeup() {
+      SYSCTRL->VREF.reg |= SYSCTRL_VREF_TSEN; // Enable the temperature sensor
+      TemperatureZeroAdc::sync();
+    }
+
+    void disable() {
+      SYSCTRL->VREF.reg &= ~SYSCTRL_VREF_TSEN; // Disable the temperature sensor
+      TemperatureZeroAdc::sync();
+    }
+
+    // Shares the ADC with the TemperatureZero instances like their reads do, see TemperatureZero::claimAdc()
+    uint16_t readInternalTemperatureRaw() {
+      uint16_t adcReading;
+      TemperatureZeroAdc::lock();
+      while (!TemperatureZero::claimAdc()) {
+        // A buffer keeps the ADC converting the temperature channel, so take its most recent sample
+        if (TemperatureZero::readLatestSample(adcReading)) {
+          TemperatureZeroAdc::unlock();
+          return adcReading;
+        }
+      }
+      TemperatureZeroAdc::acquire();
+      if (TemperatureZeroAdc::configure(TemperatureZero::adcSettings(0))) {
+        // The first conversion after the reference is changed must not be used.
+        TemperatureZeroAdc::convert();
+      }
+      if (averagingControl != 0) {
+        TemperatureZeroAdc::configure(TemperatureZero::adcSettings(averagingControl));
+      }
+      adcReading = TemperatureZeroAdc::convert();
+      TemperatureZeroAdc::release();
+      TemperatureZero::unclaimAdc();
+      TemperatureZeroAdc::unlock();
+      return adcReading;
+    }
+
+    float readInternalTemperature() {
+      return raw2temp(readInternalTemperatureRaw());
+    }
+
+    float raw2temp(uint16_t adcReading) {
+      return TemperatureZeroMath::raw2temp(_conversion, (float)adcReading);
+    }
+
+    void raw2temp(const uint16_t *adcReadings, float *temperatures, size_t count) {
+      TemperatureZeroMath::raw2temp(_conversion, adcReadings, temperatures, count);
+    }
+
+  private:
+    TemperatureZeroQuadratic _conversion;
+};
+
+template <class Config>
+constexpr uint8_t TemperatureZeroT<Config>::averagingControl;
+
+#endif
+#endif